@@ -66,6 +66,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #    define LAYER_STATE_8BIT
 #endif
 
+// Keyball's configuration in EEPROM (keyball_eeconfig_t).  kb dword holds
+// the version, whose bit 31 keyball_config_t stored there before never sets.
+#ifndef EECONFIG_KB_DATA_SIZE
+#    define EECONFIG_KB_DATA_SIZE 8
+#    define EECONFIG_KB_DATA_VERSION (0x80000000 | EECONFIG_KB_DATA_SIZE)
+#endif
+
 // To squeeze firmware size
 #undef LOCKING_SUPPORT_ENABLE
 #undef LOCKING_RESYNC_ENABLE
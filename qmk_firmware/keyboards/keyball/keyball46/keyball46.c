@@ -51,6 +51,10 @@ static uint8_t peek_matrix_intersection(pin_t out_pin, pin_t in_pin) {
 }
 
 bool is_keyboard_left(void) {
+    // peek the matrix only until the topology is resolved.
+    if (keyball.topo.ready) {
+        return keyball.topo.is_left;
+    }
     return !peek_matrix_intersection(keyball.this_have_ball ? F7 : F6, B5);
 }
 
@@ -38,6 +38,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define KEYBALL_CPI_DEFAULT 750      // 光学センサーPMW3360DM の解像度 (CPI) の規定値
 
+#define KEYBALL_AUTO_MOUSE_ENABLE 1      // 自動マウスレイヤーを有効にする
+#define KEYBALL_AUTO_MOUSE_LAYER 4       // 自動で有効になるレイヤー
+#define KEYBALL_AUTO_MOUSE_THRESHOLD 2   // レイヤーが有効になる移動量
+#define KEYBALL_AUTO_MOUSE_TIMEOUT 800   // レイヤーが無効になるまでの時間 (ms)
+
 
 #undef LOCKING_SUPPORT_ENABLE
 #undef LOCKING_RESYNC_ENABLE
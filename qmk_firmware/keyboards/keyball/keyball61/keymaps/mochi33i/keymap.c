@@ -41,145 +41,16 @@ enum custom_keycodes {
 // 最もスクロール遅い 【SCRL_DVD: 0x5DAE】スクロール除数を１つ下げます(min D0 =
 // 1/1)← 最もスクロール速い
 
-////////////////////////////////////
-///
-/// 自動マウスレイヤーの実装 ここから
-/// 参考にさせていただいたページ
-/// https://zenn.dev/takashicompany/articles/69b87160cda4b9
-///
-////////////////////////////////////
-
-enum click_state {
-  NONE = 0,
-  WAITING, // マウスレイヤーが有効になるのを待つ。 Wait for mouse layer to
-           // activate.
-  CLICKABLE, // マウスレイヤー有効になりクリック入力が取れる。 Mouse layer is
-             // enabled to take click input.
-  CLICKING,  // クリック中。 Clicking.
-};
-
-enum click_state
-    state; // 現在のクリック入力受付の状態 Current click input reception status
-uint16_t click_timer; // タイマー。状態に応じて時間で判定する。 Timer. Time to
-                      // determine the state of the system.
-
-uint16_t to_reset_time =
-    800; // この秒数(千分の一秒)、CLICKABLE状態ならクリックレイヤーが無効になる。
-         // For this number of seconds (milliseconds), the
-         // click layer is disabled if in CLICKABLE state.
-
-const int16_t to_clickable_movement = 2; // クリックレイヤーが有効になるしきい値
-const uint16_t click_layer =
-    4; // マウス入力が可能になった際に有効になるレイヤー。Layers
-       // enabled when mouse input is enabled
-
-int16_t mouse_record_threshold =
-    30; // ポインターの動きを一時的に記録するフレーム数。 Number of frames in
-        // which the pointer movement is temporarily recorded.
-int16_t mouse_move_count_ratio =
-    5; // ポインターの動きを再生する際の移動フレームの係数。 The coefficient of
-       // the moving frame when replaying the pointer movement.
-
-int16_t mouse_movement;
-
-// クリック用のレイヤーを有効にする。　Enable layers for clicks
-void enable_click_layer(void) {
-  layer_on(click_layer);
-  click_timer = timer_read();
-  state = CLICKABLE;
-}
-
-// クリック用のレイヤーを無効にする。 Disable layers for clicks.
-void disable_click_layer(void) {
-  state = NONE;
-  layer_off(click_layer);
+// 自動マウスレイヤーは lib/keyball に移動した (config.h の KEYBALL_AUTO_MOUSE_*)
+// Auto mouse layer is provided by lib/keyball (see KEYBALL_AUTO_MOUSE_* in
+// config.h).
+
+// 自前のマウスボタンでは自動マウスレイヤーを解除しない。
+// Custom mouse buttons keep auto mouse layer.
+bool keyball_auto_mouse_ignore(uint16_t keycode) {
+  return keycode >= KC_MY_BTN1 && keycode <= KC_MY_BTN3;
 }
 
-// 自前の絶対数を返す関数。 Functions that return absolute numbers.
-int16_t my_abs(int16_t num) {
-  if (num < 0) {
-    num = -num;
-  }
-
-  return num;
-}
-
-// 自前の符号を返す関数。 Function to return the sign.
-int16_t mmouse_move_y_sign(int16_t num) {
-  if (num < 0) {
-    return -1;
-  }
-
-  return 1;
-}
-
-// 現在クリックが可能な状態か。 Is it currently clickable?
-bool is_clickable_mode(void) { return state == CLICKABLE || state == CLICKING; }
-
-report_mouse_t pointing_device_task_user(report_mouse_t mouse_report) {
-  int16_t current_x = mouse_report.x;
-  int16_t current_y = mouse_report.y;
-
-  if (current_x != 0 || current_y != 0) {
-
-    switch (state) {
-    case CLICKABLE:
-      click_timer = timer_read();
-      break;
-
-    case CLICKING:
-      break;
-
-    case WAITING:
-      mouse_movement += my_abs(current_x) + my_abs(current_y);
-
-      if (mouse_movement >= to_clickable_movement) {
-        mouse_movement = 0;
-        enable_click_layer();
-      }
-      break;
-
-    default:
-      click_timer = timer_read();
-      state = WAITING;
-      mouse_movement = 0;
-    }
-  } else {
-    switch (state) {
-    case CLICKING:
-      break;
-
-    case CLICKABLE:
-      if (timer_elapsed(click_timer) > to_reset_time) {
-        disable_click_layer();
-      }
-      break;
-
-    case WAITING:
-      if (timer_elapsed(click_timer) > 50) {
-        mouse_movement = 0;
-        state = NONE;
-      }
-      break;
-
-    default:
-      mouse_movement = 0;
-      state = NONE;
-    }
-  }
-
-  mouse_report.x = current_x;
-  mouse_report.y = current_y;
-
-  return mouse_report;
-}
-
-////////////////////////////////////
-///
-/// 自動マウスレイヤーの実装 ここまで
-///
-////////////////////////////////////
-
 // clang-format off
 const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
   // main
@@ -253,28 +124,8 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
   case KC_MY_BTN1:
   case KC_MY_BTN2:
   case KC_MY_BTN3: {
-    report_mouse_t currentReport = pointing_device_get_report();
-
-    // どこのビットを対象にするか。 Which bits are to be targeted?
-    uint8_t btn = 1 << (keycode - KC_MY_BTN1);
-
-    if (record->event.pressed) {
-      // ビットORは演算子の左辺と右辺の同じ位置にあるビットを比較して、両方のビットのどちらかが「1」の場合に「1」にします。
-      // Bit OR compares bits in the same position on the left and right sides
-      // of the operator and sets them to "1" if either of both bits is "1".
-      currentReport.buttons |= btn;
-      state = CLICKING;
-    } else {
-      // ビットANDは演算子の左辺と右辺の同じ位置にあるビットを比較して、両方のビットが共に「1」の場合だけ「1」にします。
-      // Bit AND compares the bits in the same position on the left and right
-      // sides of the operator and sets them to "1" only if both bits are "1"
-      // together.
-      currentReport.buttons &= ~btn;
-      enable_click_layer();
-    }
-
-    pointing_device_set_report(currentReport);
-    pointing_device_send();
+    // ボタンの変化はすぐに送信する。 Send button changes immediately.
+    keyball_send_button(keycode - KC_MY_BTN1, record->event.pressed);
     return false;
     break;
   case MC_ESC:
@@ -303,10 +154,6 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
       // キーコード QMKBEST が放された時
     }
     break;
-  default:
-    if (record->event.pressed) {
-      disable_click_layer();
-    }
   }
   }
 
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Reference client to switch host profiles of Keyball by raw HID.
+
+Keyball firmware must be built with KEYBALL_HOST_PROFILE_ENABLE and
+RAW_ENABLE (or VIA_ENABLE).  See keyball.h for the protocol.
+
+    $ keyball_profile.py get
+    $ keyball_profile.py set 2
+    $ keyball_profile.py set 0        # back to no host profile
+
+It uses hidapi (python "hid" module) when it is installed, otherwise Linux
+hidraw devices directly.  With --loopback, requests are sent to the loopback
+harness (loopback/loopback.c) instead of a device.
+"""
+
+import argparse
+import glob
+import os
+import select
+import subprocess
+import sys
+
+VENDOR_ID = 0x5957
+RAW_USAGE_PAGE = 0xFF60
+RAW_USAGE = 0x61
+PACKET_SIZE = 32
+
+KEYBALL_RAW_ID = 0x4B
+KEYBALL_RAW_SET_PROFILE = 0x01
+KEYBALL_RAW_GET_PROFILE = 0x02
+
+
+class HidapiDevice:
+    """Raw HID interface of Keyball opened by hidapi."""
+
+    def __init__(self, pid):
+        import hid
+
+        for info in hid.enumerate(VENDOR_ID, 0):
+            if pid is not None and info["product_id"] != pid:
+                continue
+            if info["usage_page"] == RAW_USAGE_PAGE and info["usage"] == RAW_USAGE:
+                self.dev = hid.device()
+                self.dev.open_path(info["path"])
+                return
+        raise OSError("raw HID interface of Keyball not found")
+
+    def transfer(self, packet):
+        # the first byte is report ID, which raw HID doesn't use.
+        self.dev.write(b"\x00" + packet)
+        return bytes(self.dev.read(PACKET_SIZE, 1000))
+
+
+class HidrawDevice:
+    """Raw HID interface of Keyball opened by Linux hidraw."""
+
+    def __init__(self, pid):
+        for node in sorted(glob.glob("/sys/class/hidraw/hidraw*")):
+            if self._match(node, pid):
+                path = "/dev/" + os.path.basename(node)
+                self.fd = os.open(path, os.O_RDWR)
+                return
+        raise OSError("raw HID interface of Keyball not found")
+
+    @staticmethod
+    def _match(node, pid):
+        # HID_ID=0003:00005957:00000200
+        with open(os.path.join(node, "device", "uevent")) as f:
+            ids = [line.split("=", 1)[1].strip().split(":")
+                   for line in f if line.startswith("HID_ID=")]
+        if not ids:
+            return False
+        vid, product = int(ids[0][1], 16), int(ids[0][2], 16)
+        if vid != VENDOR_ID or (pid is not None and product != pid):
+            return False
+        with open(os.path.join(node, "device", "report_descriptor"), "rb") as f:
+            desc = f.read()
+        # Usage Page (0xFF60), Usage (0x61)
+        return desc.startswith(b"\x06\x60\xff\x09\x61")
+
+    def transfer(self, packet):
+        # the first byte is report number, 0 for unnumbered reports.
+        os.write(self.fd, b"\x00" + packet)
+        if not select.select([self.fd], [], [], 1.0)[0]:
+            raise OSError("no reply from Keyball")
+        return os.read(self.fd, PACKET_SIZE)
+
+
+class LoopbackDevice:
+    """Loopback harness which runs keyball_raw_command() of firmware on the host."""
+
+    def __init__(self, command):
+        self.proc = subprocess.Popen(
+            command, shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL, universal_newlines=True)
+
+    def transfer(self, packet):
+        self.proc.stdin.write(" ".join("%02x" % b for b in packet) + "\n")
+        self.proc.stdin.flush()
+        return bytes(int(v, 16) for v in self.proc.stdout.readline().split())
+
+
+def open_device(args):
+    if args.loopback:
+        return LoopbackDevice(args.loopback)
+    try:
+        return HidapiDevice(args.pid)
+    except ImportError:
+        return HidrawDevice(args.pid)
+
+
+def request(dev, command, arg=0):
+    packet = bytes([KEYBALL_RAW_ID, command, arg]).ljust(PACKET_SIZE, b"\x00")
+    reply = dev.transfer(packet)
+    if len(reply) < 4 or reply[0] != KEYBALL_RAW_ID or reply[1] != command:
+        raise OSError("unexpected reply: " + reply.hex())
+    if reply[2] != 0:
+        raise OSError("command failed: status=%d" % reply[2])
+    return reply[3]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Switch host profiles of Keyball.")
+    parser.add_argument("--pid", type=lambda v: int(v, 0), help="product ID of Keyball")
+    parser.add_argument("--loopback", metavar="COMMAND", help="talk to the loopback harness")
+    sub = parser.add_subparsers(dest="command", required=True)
+    sub.add_parser("get", help="print the current host profile")
+    p = sub.add_parser("set", help="apply a host profile, or 0 for none")
+    p.add_argument("profile", type=int)
+    args = parser.parse_args()
+
+    try:
+        dev = open_device(args)
+        if args.command == "set":
+            profile = request(dev, KEYBALL_RAW_SET_PROFILE, args.profile)
+        else:
+            profile = request(dev, KEYBALL_RAW_GET_PROFILE)
+    except OSError as e:
+        print("keyball_profile: %s" % e, file=sys.stderr)
+        return 1
+    print(profile)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define pmw3360_MAXCPI 0x77
+#define pmw3360_Motion_Burst 0x50
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+} pmw3360_motion_t;
+
+bool pmw3360_init(void);
+void pmw3360_cpi_set(uint8_t cpi);
+void pmw3360_reg_write(uint8_t addr, uint8_t data);
+bool pmw3360_motion_burst(pmw3360_motion_t *d);
@@ -0,0 +1,133 @@
+// loopback runs keyball_raw_command() of keyball.c on a host, to check host
+// profile commands and helpers without hardware.  Each line of stdin is a
+// request in hex bytes, and its reply is written to stdout in the same form.
+// Effective CPI and scroll divider after each request are written to stderr.
+//
+//     $ echo "4b 01 01" | ./loopback
+//     4b 01 00 01 00 00 ...
+
+#include <stdio.h>
+
+#define PRODUCT_ID 0x0200 // Keyball39
+#define RAW_ENABLE
+#define KEYBALL_HOST_PROFILE_ENABLE 1
+
+#include "../../keyball.c"
+
+#define PACKET_SIZE 32 // RAW_EPSIZE
+
+const keyball_profile_t PROGMEM keyball_host_profiles[KEYBALL_HOST_PROFILE_COUNT] = {
+    [0] = {.sdiv = 3, .ssnp = KEYBALL_SCROLLSNAP_MODE_FREE + 1},
+    [1] = {.sdiv = 6, .ssnp = KEYBALL_SCROLLSNAP_MODE_VERTICAL + 1},
+    [2] = {.cpi = 8},
+};
+
+layer_state_t layer_state = 1;
+
+static uint32_t now;
+
+uint32_t timer_read32(void) {
+    return now;
+}
+
+uint16_t timer_read(void) {
+    return (uint16_t)now;
+}
+
+uint8_t get_highest_layer(layer_state_t state) {
+    uint8_t layer = 0;
+    for (; state > 1; state >>= 1) {
+        layer++;
+    }
+    return layer;
+}
+
+void tap_code16(uint16_t keycode) {}
+
+report_mouse_t pointing_device_get_report(void) {
+    return (report_mouse_t){0};
+}
+
+void pointing_device_set_report(report_mouse_t report) {}
+
+bool pointing_device_send(void) {
+    return true;
+}
+
+bool is_keyboard_master(void) {
+    return true;
+}
+
+bool is_keyboard_left(void) {
+    return true;
+}
+
+bool eeconfig_is_enabled(void) {
+    return false;
+}
+
+uint32_t eeconfig_read_kb(void) {
+    return 0;
+}
+
+void eeconfig_update_kb(uint32_t val) {}
+
+void keyboard_pre_init_user(void) {}
+
+void keyboard_post_init_user(void) {}
+
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+
+layer_state_t layer_state_set_user(layer_state_t state) {
+    return state;
+}
+
+bool pmw3360_init(void) {
+    return true;
+}
+
+void pmw3360_cpi_set(uint8_t cpi) {}
+
+void pmw3360_reg_write(uint8_t addr, uint8_t data) {}
+
+bool pmw3360_motion_burst(pmw3360_motion_t *d) {
+    return false;
+}
+
+void raw_hid_send(uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        printf(i == 0 ? "%02x" : " %02x", data[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+// parse_packet reads hex bytes of a line into a packet padded with zero.
+static void parse_packet(const char *line, uint8_t *data) {
+    memset(data, 0, PACKET_SIZE);
+    char *end;
+    for (uint8_t i = 0; i < PACKET_SIZE; i++) {
+        unsigned long v = strtoul(line, &end, 16);
+        if (end == line) {
+            break;
+        }
+        data[i] = (uint8_t)v;
+        line    = end;
+    }
+}
+
+int main(void) {
+    keyboard_post_init_kb();
+    pointing_device_driver_init();
+    char line[256];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        uint8_t data[PACKET_SIZE];
+        parse_packet(line, data);
+        now += 10;
+        raw_hid_receive(data, PACKET_SIZE);
+        fprintf(stderr, "host_profile=%u cpi=%u sdiv=%u\n", keyball.host_profile, effective_cpi(), effective_scroll_div());
+    }
+    return 0;
+}
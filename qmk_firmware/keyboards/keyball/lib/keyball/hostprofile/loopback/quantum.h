@@ -0,0 +1,106 @@
+// Minimal declarations of QMK for the loopback harness.  Only what keyball.c
+// refers with KEYBALL_HOST_PROFILE_ENABLE on a host is declared.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROGMEM
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define memcpy_P memcpy
+#define TIMER_DIFF_32(a, b) ((uint32_t)((a) - (b)))
+#define dprintf(...) \
+    do {             \
+    } while (0)
+
+typedef uint32_t layer_state_t;
+
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+
+typedef struct {
+    keypos_t key;
+    bool     pressed;
+    uint16_t time;
+} keyevent_t;
+
+typedef struct {
+    keyevent_t event;
+} keyrecord_t;
+
+typedef struct {
+    uint8_t buttons;
+    int8_t  x;
+    int8_t  y;
+    int8_t  v;
+    int8_t  h;
+} report_mouse_t;
+
+enum {
+    QK_KB_0 = 0x7E00,
+    QK_KB_1,
+    QK_KB_2,
+    QK_KB_3,
+    QK_KB_4,
+    QK_KB_5,
+    QK_KB_6,
+    QK_KB_7,
+    QK_KB_8,
+    QK_KB_9,
+    QK_KB_10,
+    QK_KB_11,
+    QK_KB_12,
+    QK_KB_13,
+    QK_KB_14,
+    QK_KB_15,
+    QK_KB_16,
+    QK_KB_17,
+    QK_KB_18,
+    QK_KB_19,
+    QK_KB_20,
+    QK_KB_21,
+    QK_KB_22,
+    QK_KB_23,
+    QK_KB_24,
+    QK_KB_25,
+    QK_KB_26,
+    QK_KB_27,
+    QK_KB_28,
+    QK_KB_29,
+    QK_KB_30,
+    QK_USER_0 = 0x7E40,
+};
+
+#define QK_MODS 0x0100
+#define QK_MODS_MAX 0x1FFF
+#define KC_NO 0x00
+#define KC_MS_BTN1 0xD1
+#define KC_MS_BTN8 0xD8
+#define KC_AUDIO_VOL_UP 0xA9
+#define KC_AUDIO_VOL_DOWN 0xAA
+#define KC_BRIGHTNESS_UP 0xBD
+#define KC_BRIGHTNESS_DOWN 0xBE
+
+extern layer_state_t layer_state;
+
+uint32_t       timer_read32(void);
+uint16_t       timer_read(void);
+uint8_t        get_highest_layer(layer_state_t state);
+void           tap_code16(uint16_t keycode);
+report_mouse_t pointing_device_get_report(void);
+void           pointing_device_set_report(report_mouse_t report);
+bool           pointing_device_send(void);
+bool           is_keyboard_master(void);
+bool           is_keyboard_left(void);
+bool           eeconfig_is_enabled(void);
+uint32_t       eeconfig_read_kb(void);
+void           eeconfig_update_kb(uint32_t val);
+void           keyboard_pre_init_user(void);
+void           keyboard_post_init_user(void);
+bool           process_record_user(uint16_t keycode, keyrecord_t *record);
+layer_state_t  layer_state_set_user(layer_state_t state);
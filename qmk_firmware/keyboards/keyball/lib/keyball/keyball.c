@@ -22,10 +22,30 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "keyball.h"
 #include "drivers/pmw3360/pmw3360.h"
+#if KEYBALL_HOST_PROFILE_ENABLE
+#    include <string.h>
+#    include "raw_hid.h"
+#endif
 
 const uint8_t CPI_DEFAULT    = KEYBALL_CPI_DEFAULT / 100;
 const uint8_t CPI_MAX        = pmw3360_MAXCPI + 1;
 const uint8_t SCROLL_DIV_MAX = 7;
+const uint8_t SCALE_DEFAULT  = 8;
+const uint8_t SCALE_MAX      = 15;
+
+_Static_assert(sizeof(keyball_config_t) == sizeof(uint32_t), "keyball_config_t must fit in EEPROM kb word");
+#if EECONFIG_KB_DATA_SIZE > 0
+_Static_assert(sizeof(keyball_eeconfig_t) == EECONFIG_KB_DATA_SIZE, "EECONFIG_KB_DATA_SIZE must be size of keyball_eeconfig_t");
+#endif
+#if KEYBALL_HOST_PROFILE_ENABLE && !defined(RAW_ENABLE)
+#    error "KEYBALL_HOST_PROFILE_ENABLE requires RAW_ENABLE"
+#endif
+_Static_assert(KEYBALL_HISTORY_SIZE >= 2 && KEYBALL_HISTORY_SIZE <= 255, "KEYBALL_HISTORY_SIZE must be in 2~255");
+// head and tail of a ring run freely in uint8_t, so the size must divide 256,
+// and a full ring of 256 samples would look empty.
+_Static_assert(KEYBALL_MOTION_RING_SIZE > 0 && (KEYBALL_MOTION_RING_SIZE & (KEYBALL_MOTION_RING_SIZE - 1)) == 0, "KEYBALL_MOTION_RING_SIZE must be power of 2");
+_Static_assert(KEYBALL_MOTION_RING_SIZE <= 128, "KEYBALL_MOTION_RING_SIZE must be 128 or less");
+_Static_assert(KEYBALL_SCROLLSNAP_LOCK_ANGLE < KEYBALL_SCROLLSNAP_UNLOCK_ANGLE && KEYBALL_SCROLLSNAP_UNLOCK_ANGLE <= 60, "KEYBALL_SCROLLSNAP_*_ANGLE must be LOCK < UNLOCK <= 60");
 
 keyball_t keyball = {
     .this_have_ball = false,
@@ -36,10 +56,15 @@ keyball_t keyball = {
     .that_motion = {0},
 
     .cpi_value   = 0,
+    .cpi_applied = 0,
     .cpi_changed = false,
 
     .scroll_mode = false,
     .scroll_div  = 0,
+
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    .aml_enable = true,
+#endif
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -47,6 +72,12 @@ keyball_t keyball = {
 
 __attribute__((weak)) void keyball_on_adjust_layout(keyball_adjust_t v) {}
 
+__attribute__((weak)) bool keyball_auto_mouse_ignore(uint16_t keycode) {
+    return false;
+}
+
+__attribute__((weak)) void keyball_on_custom_role(keyball_ball_t ball, int16_t x, int16_t y, report_mouse_t *r) {}
+
 //////////////////////////////////////////////////////////////////////////////
 // Static utilities
 
@@ -66,6 +97,21 @@ static inline int8_t clip2int8(int16_t v) {
     return (v) < -127 ? -127 : (v) > 127 ? 127 : (int8_t)v;
 }
 
+// clip_count clips a count of motion not to overflow in fixed-point stages.
+// Counts over this are clipped in a mouse report anyway.
+static inline int16_t clip_count(int16_t v) {
+    return v < -1023 ? -1023 : v > 1023 ? 1023 : v;
+}
+
+// fixq8 converts a Q8 fixed-point value to an integer, and carries the
+// remainder over to next conversion.  Rounding is symmetric about zero.
+static inline int16_t fixq8(int32_t v, int16_t *carry) {
+    v += *carry;
+    int32_t n = v / 256;
+    *carry    = v - n * 256;
+    return n < -32768 ? -32768 : n > 32767 ? 32767 : (int16_t)n;
+}
+
 #ifdef OLED_ENABLE
 static const char *format_4d(int8_t d) {
     static char buf[5] = {0}; // max width (4) + NUL (1)
@@ -100,152 +146,1376 @@ static char to_1x(uint8_t x) {
 }
 #endif
 
+//////////////////////////////////////////////////////////////////////////////
+// Motion ring
+
+// compiler barrier, to publish a sample before moving an index.
+#define ring_barrier() __asm__ __volatile__("" ::: "memory")
+
+// motion_ring_flush pushes spilled motion to a ring, if the ring has room.
+// Only the producer can call this.
+static void motion_ring_flush(keyball_ring_t *r) {
+    if (r->spill.x == 0 && r->spill.y == 0) {
+        return;
+    }
+    uint8_t head = r->head;
+    if ((uint8_t)(head - r->tail) >= KEYBALL_MOTION_RING_SIZE) {
+        return;
+    }
+    keyball_sample_t *s = &r->buf[head & (KEYBALL_MOTION_RING_SIZE - 1)];
+    s->x                = r->spill.x;
+    s->y                = r->spill.y;
+    s->time             = timer_read32();
+    ring_barrier();
+    r->head  = head + 1;
+    r->spill = (keyball_motion_t){0};
+}
+
+// motion_ring_push pushes a motion to a ring.  When the ring is full, the
+// motion is merged to spill and pushed later, so no motion is lost.
+// Only the producer can call this.
+static void motion_ring_push(keyball_ring_t *r, int16_t x, int16_t y) {
+    r->spill.x = add16(r->spill.x, x);
+    r->spill.y = add16(r->spill.y, y);
+    motion_ring_flush(r);
+}
+
+// motion_ring_pop pops the oldest sample from a ring.  It returns false when
+// the ring is empty.  Only the consumer can call this.
+static bool motion_ring_pop(keyball_ring_t *r, keyball_sample_t *s) {
+    uint8_t tail = r->tail;
+    if (tail == r->head) {
+        return false;
+    }
+    ring_barrier();
+    *s = r->buf[tail & (KEYBALL_MOTION_RING_SIZE - 1)];
+    ring_barrier();
+    r->tail = tail + 1;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Motion history
+
+#if KEYBALL_HISTORY_ENABLE
+static keyball_history_t *get_history(keyball_ball_t ball) {
+    return ball == KEYBALL_BALL_THAT ? &keyball.that_history : &keyball.this_history;
+}
+
+static keyball_sample_t *history_at(keyball_history_t *h, uint8_t index) {
+    uint16_t i = h->head + KEYBALL_HISTORY_SIZE - 1 - index;
+    return &h->buf[i % KEYBALL_HISTORY_SIZE];
+}
+
+// history_drop drops the oldest sample out of the window.
+static void history_drop(keyball_history_t *h) {
+    keyball_sample_t *s = history_at(h, h->count - 1);
+    h->sum_x -= s->x;
+    h->sum_y -= s->y;
+    h->since = s->time;
+    h->count--;
+}
+
+// history_expire drops samples which are older than the window.
+static void history_expire(keyball_history_t *h, uint32_t now) {
+    while (h->count > 0 && TIMER_DIFF_32(now, history_at(h, h->count - 1)->time) >= KEYBALL_HISTORY_WINDOW) {
+        history_drop(h);
+    }
+}
+
+// history_add adds a sample to the history.  When the history is full, the
+// oldest sample is dropped and the window gets shorter.
+static void history_add(keyball_history_t *h, int16_t x, int16_t y, uint32_t time) {
+    history_expire(h, time);
+    if (h->count == 0) {
+        h->since = time - KEYBALL_HISTORY_WINDOW;
+    } else if (h->count >= KEYBALL_HISTORY_SIZE) {
+        history_drop(h);
+    }
+    h->buf[h->head] = (keyball_sample_t){.x = x, .y = y, .time = time};
+    h->head         = (h->head + 1) % KEYBALL_HISTORY_SIZE;
+    h->count++;
+    h->sum_x += x;
+    h->sum_y += y;
+}
+
+// history_velocity estimates velocity over the window which ends at now.
+static keyball_velocity_t history_velocity(keyball_history_t *h, uint32_t now) {
+    keyball_velocity_t v = {0};
+    history_expire(h, now);
+    // samples in the history are accumulated after the time "since".
+    uint32_t span = TIMER_DIFF_32(now, h->since);
+    if (span == 0 || span > KEYBALL_HISTORY_WINDOW) {
+        span = KEYBALL_HISTORY_WINDOW;
+    }
+    int32_t x = h->sum_x * 256 / (int32_t)span;
+    int32_t y = h->sum_y * 256 / (int32_t)span;
+    v.x       = x < -32768 ? -32768 : x > 32767 ? 32767 : x;
+    v.y       = y < -32768 ? -32768 : y > 32767 ? 32767 : y;
+    return v;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Auto mouse layer
+
+#if KEYBALL_AUTO_MOUSE_ENABLE
+// gap of motion which resets distance to turn on auto mouse layer.
+#    define AUTO_MOUSE_WAIT 50
+
+static void auto_mouse_off(void) {
+    keyball.aml_held     = 0;
+    keyball.aml_distance = 0;
+    if (keyball.aml_active) {
+        keyball.aml_active = false;
+        layer_off(KEYBALL_AUTO_MOUSE_LAYER);
+    }
+}
+
+// auto_mouse_motion feeds pointer motion to auto mouse layer.
+static void auto_mouse_motion(int16_t x, int16_t y) {
+    if (!keyball.aml_enable) {
+        return;
+    }
+    uint32_t now = timer_read32();
+    if (!keyball.aml_active) {
+        if (TIMER_DIFF_32(now, keyball.aml_last) >= AUTO_MOUSE_WAIT) {
+            keyball.aml_distance = 0;
+        }
+        uint16_t d           = abs(x) + abs(y);
+        keyball.aml_distance = d > UINT16_MAX - keyball.aml_distance ? UINT16_MAX : keyball.aml_distance + d;
+        if (keyball.aml_distance >= KEYBALL_AUTO_MOUSE_THRESHOLD) {
+            keyball.aml_active = true;
+            layer_on(KEYBALL_AUTO_MOUSE_LAYER);
+        }
+    }
+    keyball.aml_last = now;
+}
+
+// auto_mouse_process updates auto mouse layer by a key event.
+static void auto_mouse_process(uint16_t keycode, keyrecord_t *record) {
+    if (!keyball.aml_enable) {
+        return;
+    }
+    if (keycode >= QK_MODS && keycode <= QK_MODS_MAX) {
+        keycode &= 0xff;
+    }
+    bool ignored = IS_MOUSEKEY(keycode) || IS_MODIFIER_KEYCODE(keycode) || IS_QK_KB(keycode) || IS_QK_MOMENTARY(keycode) || keyball_auto_mouse_ignore(keycode);
+    if (!ignored) {
+        if (record->event.pressed) {
+            auto_mouse_off();
+        }
+        return;
+    }
+    if (!keyball.aml_active) {
+        return;
+    }
+    // hold the layer while ignored keys are pressed.
+    if (record->event.pressed) {
+        keyball.aml_held++;
+    } else if (keyball.aml_held > 0) {
+        keyball.aml_held--;
+        keyball.aml_last = timer_read32();
+    }
+}
+
+// auto_mouse_task turns off auto mouse layer after timeout.
+static void auto_mouse_task(void) {
+#    if KEYBALL_DRAG_LOCK_ENABLE
+    // keep the layer while dragging.
+    if (keyball.drag_btn != 0) {
+        keyball.aml_last = timer_read32();
+        return;
+    }
+#    endif
+    if (keyball.aml_active && keyball.aml_held == 0 && TIMER_DIFF_32(timer_read32(), keyball.aml_last) >= KEYBALL_AUTO_MOUSE_TIMEOUT) {
+        auto_mouse_off();
+    }
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Drag lock
+
+#if KEYBALL_DRAG_LOCK_ENABLE
+static void drag_lock_release(void) {
+    if (keyball.drag_btn != 0) {
+        uint8_t btn      = keyball.drag_btn - 1;
+        keyball.drag_btn = 0;
+        keyball_send_button(btn, false);
+    }
+}
+
+static void drag_lock_motion(void) {
+    if (keyball.drag_btn != 0) {
+        keyball.drag_moved = true;
+        keyball.drag_last  = timer_read32();
+    }
+}
+
+// drag_lock_press handles press of a mouse button while latched.  Latch of
+// the same button is just cleared, so that its release ends the drag.  With
+// mouse keys, the release doesn't touch the button latched in the report of
+// pointing device, so it is released here.
+static void drag_lock_press(uint8_t btn) {
+#ifndef MOUSEKEY_ENABLE
+    if (keyball.drag_btn == btn + 1) {
+        keyball.drag_btn = 0;
+        return;
+    }
+#endif
+    drag_lock_release();
+}
+
+static void drag_lock_task(void) {
+    if (keyball.drag_btn == 0 || keyball.drag_hold) {
+        return;
+    }
+    uint32_t elapsed = TIMER_DIFF_32(timer_read32(), keyball.drag_last);
+    if (elapsed >= (keyball.drag_moved ? KEYBALL_DRAG_LOCK_IDLE : KEYBALL_DRAG_LOCK_TIMEOUT)) {
+        drag_lock_release();
+    }
+}
+#endif
+
+void keyball_toggle_drag_lock(uint8_t btn, bool hold) {
+#if KEYBALL_DRAG_LOCK_ENABLE
+    if (keyball.drag_btn != 0) {
+        drag_lock_release();
+        return;
+    }
+    keyball.drag_btn   = btn + 1;
+    keyball.drag_hold  = hold;
+    keyball.drag_moved = false;
+    keyball.drag_last  = timer_read32();
+    keyball_send_button(btn, true);
+#endif
+}
+
 static void add_cpi(int8_t delta) {
     int16_t v = keyball_get_cpi() + delta;
     keyball_set_cpi(v < 1 ? 1 : v);
 }
 
+static void add_scale_x(int8_t delta) {
+    int8_t v = keyball_get_scale_x() + delta;
+    keyball_set_scale_x(v < 1 ? 1 : v);
+}
+
+static void add_scale_y(int8_t delta) {
+    int8_t v = keyball_get_scale_y() + delta;
+    keyball_set_scale_y(v < 1 ? 1 : v);
+}
+
+static void add_rotation(int16_t delta) {
+    keyball_set_rotation(keyball_get_rotation() + delta);
+}
+
 static void add_scroll_div(int8_t delta) {
     int8_t v = keyball_get_scroll_div() + delta;
     keyball_set_scroll_div(v < 1 ? 1 : v);
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Pointing device driver
-
-#if KEYBALL_MODEL == 46
-void keyboard_pre_init_kb(void) {
-    keyball.this_have_ball = pmw3360_init();
-    keyboard_pre_init_user();
+// add_scroll_div_frac steps scroll divider by 1/4, carrying the fraction to
+// the divider.
+static void add_scroll_div_frac(int8_t delta) {
+    int8_t q   = (keyball_get_scroll_div() - 1) * 4 + keyball.scroll_div_frac + delta;
+    int8_t max = (SCROLL_DIV_MAX - 1) * 4;
+    q          = q < 0 ? 0 : q > max ? max : q;
+    keyball_set_scroll_div(q / 4 + 1);
+    keyball_set_scroll_div_frac(q % 4);
+}
+
+// effective_cpi returns CPI with the active profile applied.
+static uint8_t effective_cpi(void) {
+#if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.cpi != 0) {
+        return keyball.profile.cpi;
+    }
+#endif
+    return keyball_get_cpi();
+}
+
+// effective_scroll_div returns scroll divider with the active profile applied.
+static uint8_t effective_scroll_div(void) {
+#if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.sdiv != 0) {
+        return keyball.profile.sdiv;
+    }
+#endif
+    return keyball_get_scroll_div();
+}
+
+// 2^(-n/4) in Q12, for fraction of scroll divider.
+static const uint16_t PROGMEM scroll_frac_q12[] = {4096, 3444, 2896, 2435};
+
+// scroll_ratio returns wheel units per count in Q12, with the active profile
+// applied.
+static uint16_t scroll_ratio(void) {
+    uint8_t frac = keyball.scroll_div_frac;
+#if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.sdiv != 0) {
+        frac = 0;
+    }
+#endif
+    return pgm_read_word(scroll_frac_q12 + frac) >> (effective_scroll_div() - 1);
+}
+
+// sync_cpi pushes effective CPI to the sensor and the secondary half, only
+// when it is changed.
+static void sync_cpi(void) {
+    uint8_t cpi = effective_cpi();
+    if (cpi == keyball.cpi_applied) {
+        return;
+    }
+    keyball.cpi_applied = cpi;
+    keyball.cpi_changed = true;
+    if (keyball.this_have_ball) {
+        pmw3360_cpi_set(cpi - 1);
+        pmw3360_reg_write(pmw3360_Motion_Burst, 0);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Rotation
+
+#if KEYBALL_ROTATION_ENABLE
+// clang-format off
+// sine of 0~90 degrees in Q14.
+static const uint16_t PROGMEM sin_q14_table[] = {
+        0,   286,   572,   857,  1143,  1428,  1713,  1997,  2280,  2563,
+     2845,  3126,  3406,  3686,  3964,  4240,  4516,  4790,  5063,  5334,
+     5604,  5872,  6138,  6402,  6664,  6924,  7182,  7438,  7692,  7943,
+     8192,  8438,  8682,  8923,  9162,  9397,  9630,  9860, 10087, 10311,
+    10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+    12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+    14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+    15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+    16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+    16384,
+};
+// clang-format on
+
+// sin_q14 returns sine of an angle (0~359 degrees) in Q14.
+static int16_t sin_q14(uint16_t deg) {
+    bool neg = deg >= 180;
+    if (neg) {
+        deg -= 180;
+    }
+    if (deg > 90) {
+        deg = 180 - deg;
+    }
+    int16_t v = pgm_read_word(sin_q14_table + deg);
+    return neg ? -v : v;
+}
+
+// rotate_motion rotates a motion of sensor by configured angle.  Rotation is
+// reversed in sensor coordinates, because all models mirror sensor axes to
+// screen ones.
+static void rotate_motion(int16_t *x, int16_t *y, keyball_motion_t *c) {
+    if (keyball.rotation == 0) {
+        return;
+    }
+    uint16_t deg = 360 - keyball.rotation;
+    int32_t  s   = sin_q14(deg);
+    int32_t  k   = sin_q14(deg >= 270 ? deg - 270 : deg + 90);
+    int32_t  rx  = (*x * k - *y * s) / 64;
+    int32_t  ry  = (*x * s + *y * k) / 64;
+    *x           = fixq8(rx, &c->x);
+    *y           = fixq8(ry, &c->y);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Pointing device driver
+
+#if KEYBALL_MODEL == 46
+void keyboard_pre_init_kb(void) {
+    keyball.this_have_ball = pmw3360_init();
+    keyboard_pre_init_user();
+}
+#endif
+
+// topology_resolve caches handedness and axis mapping of trackballs.
+static void topology_resolve(void) {
+    bool is_left = is_keyboard_left();
+#if KEYBALL_MODEL == 61 || KEYBALL_MODEL == 39 || KEYBALL_MODEL == 147 || KEYBALL_MODEL == 44
+    // sensors are mounted rotated, and mirrored on each side.
+    keyball.topo.axis[KEYBALL_BALL_THIS] = (keyball_axis_map_t){.swap = 1, .neg_x = is_left, .neg_y = is_left};
+    keyball.topo.axis[KEYBALL_BALL_THAT] = (keyball_axis_map_t){.swap = 1, .neg_x = !is_left, .neg_y = !is_left};
+#elif KEYBALL_MODEL == 46
+    keyball.topo.axis[KEYBALL_BALL_THIS] = (keyball_axis_map_t){.neg_y = 1};
+    keyball.topo.axis[KEYBALL_BALL_THAT] = (keyball_axis_map_t){.neg_y = 1};
+#else
+#    error("unknown Keyball model")
+#endif
+    keyball.topo.is_left = is_left;
+    keyball.topo.ready   = true;
+}
+
+void pointing_device_driver_init(void) {
+#if KEYBALL_MODEL != 46
+    keyball.this_have_ball = pmw3360_init();
+#endif
+    topology_resolve();
+    if (keyball.this_have_ball) {
+        pmw3360_cpi_set(CPI_DEFAULT - 1);
+        pmw3360_reg_write(pmw3360_Motion_Burst, 0);
+        keyball.cpi_applied = CPI_DEFAULT;
+    }
+}
+
+uint16_t pointing_device_driver_get_cpi(void) {
+    return keyball_get_cpi();
+}
+
+void pointing_device_driver_set_cpi(uint16_t cpi) {
+    keyball_set_cpi(cpi);
+}
+
+#if KEYBALL_PROFILE_ENABLE
+// slopes of acceleration curves, indexed by keyball_accel_t.
+static const uint8_t PROGMEM accel_slope[] = {0, 4, 8, 16};
+
+// accel_gain returns pointer gain (Q8) for the motion of a report.
+static int16_t accel_gain(int16_t x, int16_t y) {
+    uint8_t accel = keyball.profile.accel;
+    if (accel == KEYBALL_ACCEL_NONE || accel >= sizeof(accel_slope)) {
+        return 256;
+    }
+    int32_t g = 256 + (int32_t)pgm_read_byte(accel_slope + accel) * (abs(x) + abs(y));
+    return g > 1024 ? 1024 : (int16_t)g;
+}
+#endif
+
+// motion_to_screen converts motion of a sensor to screen axes.
+static void motion_to_screen(const keyball_motion_t *m, keyball_ball_t ball, int16_t *x, int16_t *y) {
+    keyball_axis_map_t a  = keyball.topo.axis[ball];
+    int16_t            sx = a.swap ? m->y : m->x;
+    int16_t            sy = a.swap ? m->x : m->y;
+    *x                    = a.neg_x ? -sx : sx;
+    *y                    = a.neg_y ? -sy : sy;
+}
+
+static void motion_to_mouse_move(keyball_motion_t *m, keyball_motion_t *c, report_mouse_t *r, keyball_ball_t ball) {
+    int16_t x, y;
+    motion_to_screen(m, ball, &x, &y);
+    // clear motion
+    m->x = 0;
+    m->y = 0;
+
+    // apply scale per screen axis in Q8 (1/8 unit = 32).
+    int32_t fx = (int32_t)clip_count(x) * keyball_get_scale_x() * 32;
+    int32_t fy = (int32_t)clip_count(y) * keyball_get_scale_y() * 32;
+#if KEYBALL_PROFILE_ENABLE
+    // apply acceleration of the profile.
+    int16_t g = accel_gain(x, y);
+    fx        = fx * g / 256;
+    fy        = fy * g / 256;
+#endif
+    x = fixq8(fx, &c->x);
+    y = fixq8(fy, &c->y);
+
+#if KEYBALL_PROFILE_ENABLE
+    // apply axis lock of the profile.
+    if (keyball.profile.axis == KEYBALL_AXIS_HORIZONTAL) {
+        y    = 0;
+        c->y = 0;
+    } else if (keyball.profile.axis == KEYBALL_AXIS_VERTICAL) {
+        x    = 0;
+        c->x = 0;
+    }
+#endif
+    r->x = clip2int8(x);
+    r->y = clip2int8(y);
+}
+
+// scroll_units converts counts to wheel units by a ratio in Q12.  Division
+// truncates toward zero and the remainder is carried exactly, so that both
+// directions are equally sensitive.
+static int16_t scroll_units(int16_t v, uint32_t ratio, int16_t *carry) {
+    int32_t acc = (int32_t)clip_count(v) * (int32_t)ratio + *carry;
+    int32_t u   = acc / 4096;
+    *carry      = acc - u * 4096;
+    return u < -INT16_MAX ? -INT16_MAX : u > INT16_MAX ? INT16_MAX : u;
+}
+
+#if KEYBALL_SCROLLSNAP_ENABLE
+// SCROLLSNAP_TAN_Q8 is tangent of an angle in Q8, by Pade approximant which
+// is accurate enough up to 60 degrees.  It is folded at compile time.
+#    define SCROLLSNAP_RAD(deg) ((deg)*3.14159265 / 180)
+#    define SCROLLSNAP_TAN_Q8(deg) (int16_t)(256 * SCROLLSNAP_RAD(deg) * (15 - SCROLLSNAP_RAD(deg) * SCROLLSNAP_RAD(deg)) / (15 - 6 * SCROLLSNAP_RAD(deg) * SCROLLSNAP_RAD(deg)) + 0.5)
+
+static const int16_t scroll_snap_lock_tan   = SCROLLSNAP_TAN_Q8(KEYBALL_SCROLLSNAP_LOCK_ANGLE);
+static const int16_t scroll_snap_unlock_tan = SCROLLSNAP_TAN_Q8(KEYBALL_SCROLLSNAP_UNLOCK_ANGLE);
+
+// scroll_snap_within checks direction of motion is within an angle from the
+// major axis, by tangent of the angle.
+static bool scroll_snap_within(uint16_t minor, uint16_t major, int16_t tan_q8) {
+    return (uint32_t)minor * 256 <= (uint32_t)major * tan_q8;
+}
+
+// scroll_snap_update updates the locked axis of auto mode, with motion on
+// screen axes.  Until direction is decided, scroll follows the dominant axis.
+// After that, direction is measured by leaky sum of motion, and a lock is
+// released at wider angle than taken, not to flap around the boundary.
+static void scroll_snap_update(int16_t x, int16_t y) {
+    uint32_t now = timer_read32();
+    if (TIMER_DIFF_32(now, keyball.scroll_snap_last) >= KEYBALL_SCROLLSNAP_RESET_TIMER) {
+        keyball.scroll_snap_decided = false;
+        keyball.scroll_snap_x       = 0;
+        keyball.scroll_snap_y       = 0;
+    }
+    if (x == 0 && y == 0) {
+        return;
+    }
+    keyball.scroll_snap_last = now;
+
+    uint16_t ax = keyball.scroll_snap_x;
+    uint16_t ay = keyball.scroll_snap_y;
+    if (keyball.scroll_snap_decided) {
+        ax -= ax / 4;
+        ay -= ay / 4;
+    }
+    ax += abs(clip_count(x));
+    ay += abs(clip_count(y));
+    keyball.scroll_snap_x = ax;
+    keyball.scroll_snap_y = ay;
+
+    uint8_t  major = ax > ay ? KEYBALL_AXIS_HORIZONTAL : KEYBALL_AXIS_VERTICAL;
+    uint16_t hi    = ax > ay ? ax : ay;
+    uint16_t lo    = ax > ay ? ay : ax;
+    if (!keyball.scroll_snap_decided) {
+        keyball.scroll_snap_axis = major;
+        if (ax + ay < KEYBALL_SCROLLSNAP_THRESHOLD) {
+            return;
+        }
+        keyball.scroll_snap_decided = true;
+        if (!scroll_snap_within(lo, hi, scroll_snap_lock_tan)) {
+            keyball.scroll_snap_axis = KEYBALL_AXIS_FREE;
+        }
+        return;
+    }
+    if (keyball.scroll_snap_axis == KEYBALL_AXIS_FREE) {
+        if (scroll_snap_within(lo, hi, scroll_snap_lock_tan)) {
+            keyball.scroll_snap_axis = major;
+        }
+    } else if (keyball.scroll_snap_axis != major || !scroll_snap_within(lo, hi, scroll_snap_unlock_tan)) {
+        keyball.scroll_snap_axis = KEYBALL_AXIS_FREE;
+    }
+}
+
+// scroll_snap locks scroll in a report to an axis, by the mode.  x and y
+// are motion on screen axes which the report is made from.
+static void scroll_snap(report_mouse_t *r, int16_t x, int16_t y) {
+    uint8_t axis = KEYBALL_AXIS_FREE;
+    uint8_t mode = keyball.scroll_snap_mode;
+#    if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.ssnp != 0) {
+        mode = keyball.profile.ssnp - 1;
+    }
+#    endif
+    switch (mode) {
+        case KEYBALL_SCROLLSNAP_MODE_AUTO:
+            scroll_snap_update(x, y);
+            axis = keyball.scroll_snap_axis;
+            break;
+        case KEYBALL_SCROLLSNAP_MODE_VERTICAL:
+            axis = KEYBALL_AXIS_VERTICAL;
+            break;
+        case KEYBALL_SCROLLSNAP_MODE_HORIZONTAL:
+            axis = KEYBALL_AXIS_HORIZONTAL;
+            break;
+    }
+    if (axis == KEYBALL_AXIS_HORIZONTAL) {
+        r->v = 0;
+    } else if (axis == KEYBALL_AXIS_VERTICAL) {
+        r->h = 0;
+    }
+}
+#endif
+
+#if KEYBALL_SCROLL_ACCEL_ENABLE
+// scroll_accel_gain returns scroll gain (Q8) for counts of motion in a report.
+static int16_t scroll_accel_gain(int16_t counts) {
+    uint8_t slope = KEYBALL_SCROLL_ACCEL_SLOPE;
+#    if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.scroll_accel != 0) {
+        slope = keyball.profile.scroll_accel;
+    }
+#    endif
+    if (counts <= KEYBALL_SCROLL_ACCEL_OFFSET) {
+        return 256;
+    }
+    int32_t g = 256 + (int32_t)slope * (counts - KEYBALL_SCROLL_ACCEL_OFFSET);
+    return g > KEYBALL_SCROLL_ACCEL_MAX ? KEYBALL_SCROLL_ACCEL_MAX : (int16_t)g;
+}
+#endif
+
+#if KEYBALL_SCROLL_DAMPEN_ENABLE
+// scroll_dampen returns motion of an axis with small reversal just after
+// sustained scroll discarded.  Reversal which reaches the threshold is
+// intentional, and becomes new direction.
+static int16_t scroll_dampen(keyball_dampen_t *d, int16_t v, uint32_t now) {
+    if (v == 0) {
+        return 0;
+    }
+    int8_t dir = v > 0 ? 1 : -1;
+    if (dir != d->dir && d->run >= KEYBALL_SCROLL_DAMPEN_SUSTAIN && TIMER_DIFF_32(now, d->last) < KEYBALL_SCROLL_DAMPEN_TIME) {
+        d->reverse = add16(d->reverse, abs(v));
+        if (d->reverse < KEYBALL_SCROLL_DAMPEN_THRESHOLD) {
+            keyball.scroll_dampen_count++;
+            keyball.scroll_dampen_discarded += abs(v);
+            return 0;
+        }
+    }
+    if (dir != d->dir) {
+        d->dir = dir;
+        d->run = 0;
+    }
+    d->run     = add16(d->run, abs(v));
+    d->reverse = 0;
+    d->last    = now;
+    return v;
+}
+#endif
+
+// motion_to_mouse_scroll makes wheel from motion.  c is remainders of wheel
+// units in Q12, which must not be shared with pointer's stages.
+static void motion_to_mouse_scroll(keyball_motion_t *m, keyball_motion_t *c, report_mouse_t *r, keyball_ball_t ball) {
+    uint32_t ratio = scroll_ratio();
+    int16_t  x, y;
+#if KEYBALL_SCROLL_DAMPEN_ENABLE
+    uint32_t          now = timer_read32();
+    keyball_dampen_t *d   = ball == KEYBALL_BALL_THIS ? keyball.this_dampen : keyball.that_dampen;
+    m->x                  = scroll_dampen(&d[0], m->x, now);
+    m->y                  = scroll_dampen(&d[1], m->y, now);
+#endif
+#if KEYBALL_SCROLL_ACCEL_ENABLE
+    int16_t g = scroll_accel_gain(abs(clip_count(m->x)) + abs(clip_count(m->y)));
+#endif
+#if KEYBALL_SCROLLSNAP_ENABLE
+    // direction is measured by motion before the divider.
+    int16_t mx, my;
+    motion_to_screen(m, ball, &mx, &my);
+#endif
+    // consume all motion, units over a report are discarded.
+    x    = scroll_units(m->x, ratio, &c->x);
+    y    = scroll_units(m->y, ratio, &c->y);
+    m->x = 0;
+    m->y = 0;
+
+#if KEYBALL_SCROLL_ACCEL_ENABLE
+    // accelerate units of wheel, not to accelerate remainders of the divider
+    // twice.
+    keyball_motion_t *ac = ball == KEYBALL_BALL_THIS ? &keyball.this_scroll_accel_carry : &keyball.that_scroll_accel_carry;
+    x                    = fixq8((int32_t)x * g, &ac->x);
+    y                    = fixq8((int32_t)y * g, &ac->y);
+#endif
+
+    // apply to mouse report: wheel goes up for upward motion.
+    int16_t sx, sy;
+    motion_to_screen(&(keyball_motion_t){.x = x, .y = y}, ball, &sx, &sy);
+    r->h = clip2int8(sx);
+    r->v = -clip2int8(sy);
+
+#if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.axis == KEYBALL_AXIS_HORIZONTAL) {
+        r->v = 0;
+    } else if (keyball.profile.axis == KEYBALL_AXIS_VERTICAL) {
+        r->h = 0;
+    }
+#endif
+
+#if KEYBALL_SCROLLSNAP_ENABLE
+    // reset of auto mode is evaluated lazily, because this is not called
+    // while trackballs are idle.
+    scroll_snap(r, mx, my);
+#endif
+}
+
+#if KEYBALL_ARROW_ENABLE
+static void arrow_reset(void) {
+    keyball.arrow_axis = KEYBALL_AXIS_FREE;
+    keyball.arrow_x    = 0;
+    keyball.arrow_y    = 0;
+}
+
+// arrow_task taps an arrow key for accumulated motion, at most once per
+// KEYBALL_ARROW_INTERVAL ms.
+static void arrow_task(void) {
+    if (keyball.arrow_axis == KEYBALL_AXIS_FREE) {
+        return;
+    }
+    uint32_t now = timer_read32();
+    if (TIMER_DIFF_32(now, keyball.arrow_last) < KEYBALL_ARROW_INTERVAL) {
+        return;
+    }
+    bool     horizontal = keyball.arrow_axis == KEYBALL_AXIS_HORIZONTAL;
+    int16_t *a          = horizontal ? &keyball.arrow_x : &keyball.arrow_y;
+    if (abs(*a) < KEYBALL_ARROW_DIVIDER) {
+        return;
+    }
+    uint16_t kc;
+    if (*a > 0) {
+        kc = horizontal ? KEYBALL_ARROW_KEY_RIGHT : KEYBALL_ARROW_KEY_DOWN;
+        *a -= KEYBALL_ARROW_DIVIDER;
+    } else {
+        kc = horizontal ? KEYBALL_ARROW_KEY_LEFT : KEYBALL_ARROW_KEY_UP;
+        *a += KEYBALL_ARROW_DIVIDER;
+    }
+    keyball.arrow_last = now;
+    tap_code16(kc);
+}
+
+static inline int16_t arrow_add(int16_t a, int16_t d) {
+    const int16_t lim = KEYBALL_ARROW_DIVIDER * KEYBALL_ARROW_QUEUE;
+    int32_t       v   = (int32_t)a + d;
+    return v > lim ? lim : v < -lim ? -lim : v;
+}
+
+static void motion_to_arrow(keyball_motion_t *m, keyball_ball_t ball) {
+    int16_t x, y;
+    motion_to_screen(m, ball, &x, &y);
+    m->x = 0;
+    m->y = 0;
+    // release axis lock lazily, because this is not called while idle.
+    uint32_t now = timer_read32();
+    if (TIMER_DIFF_32(now, keyball.arrow_motion) >= KEYBALL_ARROW_RELEASE) {
+        arrow_reset();
+    }
+    keyball.arrow_motion = now;
+    // remainder is carried per axis, and only the locked axis accumulates.
+    if (keyball.arrow_axis != KEYBALL_AXIS_VERTICAL) {
+        keyball.arrow_x = arrow_add(keyball.arrow_x, x);
+    }
+    if (keyball.arrow_axis != KEYBALL_AXIS_HORIZONTAL) {
+        keyball.arrow_y = arrow_add(keyball.arrow_y, y);
+    }
+    if (keyball.arrow_axis == KEYBALL_AXIS_FREE) {
+        // lock to the axis which reaches a tap first.
+        if (abs(keyball.arrow_x) >= KEYBALL_ARROW_DIVIDER && abs(keyball.arrow_x) >= abs(keyball.arrow_y)) {
+            keyball.arrow_axis = KEYBALL_AXIS_HORIZONTAL;
+            keyball.arrow_y    = 0;
+        } else if (abs(keyball.arrow_y) >= KEYBALL_ARROW_DIVIDER) {
+            keyball.arrow_axis = KEYBALL_AXIS_VERTICAL;
+            keyball.arrow_x    = 0;
+        }
+    }
+    arrow_task();
+}
+#endif
+
+// motion_to_keys taps a key per KEYBALL_ROLE_KEY_DIVIDER counts of vertical
+// motion.  A key is tapped at most once per report, and excess is discarded.
+static void motion_to_keys(keyball_motion_t *m, int16_t *k, keyball_ball_t ball, uint16_t up, uint16_t down) {
+    int16_t x, y;
+    motion_to_screen(m, ball, &x, &y);
+    m->x      = 0;
+    m->y      = 0;
+    int32_t v = (int32_t)*k + y;
+    if (v <= -KEYBALL_ROLE_KEY_DIVIDER) {
+        tap_code16(up);
+        v = v + KEYBALL_ROLE_KEY_DIVIDER;
+    } else if (v >= KEYBALL_ROLE_KEY_DIVIDER) {
+        tap_code16(down);
+        v = v - KEYBALL_ROLE_KEY_DIVIDER;
+    }
+    *k = v < -KEYBALL_ROLE_KEY_DIVIDER + 1 ? -KEYBALL_ROLE_KEY_DIVIDER + 1 : v > KEYBALL_ROLE_KEY_DIVIDER - 1 ? KEYBALL_ROLE_KEY_DIVIDER - 1 : v;
+}
+
+// base_role returns how motion of a trackball is treated, without momentary
+// keys.  A role of the profile takes priority over configured one.
+static keyball_role_t base_role(keyball_ball_t ball) {
+    uint8_t role = ball == KEYBALL_BALL_THIS ? keyball.this_role : keyball.that_role;
+#if KEYBALL_PROFILE_ENABLE
+    uint8_t p = ball == KEYBALL_BALL_THIS ? keyball.profile.this_role : keyball.profile.that_role;
+    if (p != KEYBALL_ROLE_AUTO && p < KEYBALL_ROLE_COUNT) {
+        role = p;
+    }
+#endif
+    if (role != KEYBALL_ROLE_AUTO) {
+        return role;
+    }
+    // follow modes.
+    bool primary = ball == KEYBALL_BALL_THIS || !keyball.this_have_ball;
+#if KEYBALL_ARROW_ENABLE
+    if (primary && keyball.arrow_mode) {
+        return KEYBALL_ROLE_ARROW;
+    }
+#endif
+    return keyball.scroll_mode == primary ? KEYBALL_ROLE_SCROLL : KEYBALL_ROLE_POINTER;
+}
+
+// ball_role returns how motion of a trackball is treated.  Scroll turns into
+// zoom or pan while ZOOM_MO or PAN_MO is pressed.
+static keyball_role_t ball_role(keyball_ball_t ball) {
+    keyball_role_t role = base_role(ball);
+#if KEYBALL_ZOOM_PAN_ENABLE
+    if (role == KEYBALL_ROLE_SCROLL && keyball.wheel_role != KEYBALL_ROLE_AUTO) {
+        return keyball.wheel_role;
+    }
+#endif
+    return role;
+}
+
+#if KEYBALL_GESTURE_ENABLE
+static void gesture_arm(bool pressed) {
+    keyball.gesture_armed = pressed;
+    keyball.gesture_fired = false;
+    keyball.gesture_x     = 0;
+    keyball.gesture_y     = 0;
+    keyball.gesture_start = timer_read32();
+}
+
+// gesture_feed accumulates motion of a pointer to a stroke, and taps a
+// keycode when the stroke is classified as a flick.
+static void gesture_feed(keyball_motion_t *m, keyball_ball_t ball) {
+    int16_t x, y;
+    motion_to_screen(m, ball, &x, &y);
+    m->x = 0;
+    m->y = 0;
+    if (x == 0 && y == 0) {
+        return;
+    }
+    uint32_t now = timer_read32();
+    if (TIMER_DIFF_32(now, keyball.gesture_start) >= KEYBALL_GESTURE_TIME) {
+        // start a new stroke.
+        keyball.gesture_start = now;
+        keyball.gesture_fired = false;
+        keyball.gesture_x     = 0;
+        keyball.gesture_y     = 0;
+    }
+    if (keyball.gesture_fired) {
+        return;
+    }
+    keyball.gesture_x = add16(keyball.gesture_x, x);
+    keyball.gesture_y = add16(keyball.gesture_y, y);
+    uint32_t ax       = abs(keyball.gesture_x);
+    uint32_t ay       = abs(keyball.gesture_y);
+    if (ax + ay < KEYBALL_GESTURE_THRESHOLD) {
+        return;
+    }
+    // classify by the dominant axis, diagonal strokes are not gestures.
+    keyball_gesture_t g;
+    if (ax >= ay * 2) {
+        g = keyball.gesture_x > 0 ? KEYBALL_GESTURE_RIGHT : KEYBALL_GESTURE_LEFT;
+    } else if (ay >= ax * 2) {
+        g = keyball.gesture_y > 0 ? KEYBALL_GESTURE_DOWN : KEYBALL_GESTURE_UP;
+    } else {
+        return;
+    }
+    keyball.gesture_fired = true;
+    uint8_t layer         = get_highest_layer(layer_state);
+    if (layer >= KEYBALL_GESTURE_LAYER_COUNT) {
+        layer = 0;
+    }
+    uint16_t kc = pgm_read_word(&keyball_gesture_map[layer][g]);
+    if (kc != KC_NO) {
+        tap_code16(kc);
+    }
+}
+#endif
+
+#if KEYBALL_ZOOM_PAN_ENABLE
+static void zoom_release(void) {
+    if (keyball.zoom_mods) {
+        keyball.zoom_mods = false;
+        keyball.zoom_last = 0;
+        del_weak_mods(KEYBALL_ZOOM_MODS);
+        send_keyboard_report();
+    }
+}
+
+// zoom_wheel makes a wheel report for zoom.  Modifiers are sent before the
+// report is returned, so that the host gets them together with the wheel.
+// Weak modifiers are checked every time, because QMK may clear them.
+static void zoom_wheel(report_mouse_t *r) {
+    r->h = 0;
+    if (r->v == 0) {
+        return;
+    }
+    if ((get_weak_mods() & KEYBALL_ZOOM_MODS) != KEYBALL_ZOOM_MODS) {
+        add_weak_mods(KEYBALL_ZOOM_MODS);
+        send_keyboard_report();
+    }
+    keyball.zoom_mods = true;
+    keyball.zoom_last = timer_read32();
+}
+
+static void zoom_task(void) {
+    if (keyball.zoom_mods && TIMER_DIFF_32(timer_read32(), keyball.zoom_last) >= KEYBALL_ZOOM_RELEASE) {
+        zoom_release();
+    }
+}
+
+static void wheel_role_set(keyball_role_t role, bool pressed) {
+    if (pressed) {
+        keyball.wheel_role = role;
+    } else if (keyball.wheel_role == role) {
+        keyball.wheel_role = KEYBALL_ROLE_AUTO;
+    }
+    if (keyball.wheel_role != KEYBALL_ROLE_ZOOM) {
+        zoom_release();
+    }
+}
+#endif
+
+static void motion_to_mouse(keyball_ball_t ball, report_mouse_t *r) {
+    bool              this_ball = ball == KEYBALL_BALL_THIS;
+    keyball_motion_t *m         = this_ball ? &keyball.this_motion : &keyball.that_motion;
+    keyball_motion_t *c         = this_ball ? &keyball.this_carry : &keyball.that_carry;
+    keyball_motion_t *sc        = this_ball ? &keyball.this_scroll_carry : &keyball.that_scroll_carry;
+    int16_t          *k         = this_ball ? &keyball.this_keys : &keyball.that_keys;
+    // stages make motion of a ball, which is added to the report later.
+    report_mouse_t b = {0};
+    switch (ball_role(ball)) {
+        case KEYBALL_ROLE_SCROLL:
+            motion_to_mouse_scroll(m, sc, &b, ball);
+            break;
+#if KEYBALL_ARROW_ENABLE
+        case KEYBALL_ROLE_ARROW:
+            motion_to_arrow(m, ball);
+            break;
+#endif
+        case KEYBALL_ROLE_VOLUME:
+            motion_to_keys(m, k, ball, KC_AUDIO_VOL_UP, KC_AUDIO_VOL_DOWN);
+            break;
+        case KEYBALL_ROLE_BRIGHTNESS:
+            motion_to_keys(m, k, ball, KC_BRIGHTNESS_UP, KC_BRIGHTNESS_DOWN);
+            break;
+#if KEYBALL_ZOOM_PAN_ENABLE
+        case KEYBALL_ROLE_ZOOM:
+            motion_to_mouse_scroll(m, sc, &b, ball);
+            zoom_wheel(&b);
+            break;
+        case KEYBALL_ROLE_PAN:
+            // wheel goes right for downward motion, like Shift + wheel.
+            motion_to_mouse_scroll(m, sc, &b, ball);
+            b.h = clip2int8(b.h - b.v);
+            b.v = 0;
+            break;
+#endif
+        case KEYBALL_ROLE_CUSTOM: {
+            int16_t x, y;
+            motion_to_screen(m, ball, &x, &y);
+            m->x = 0;
+            m->y = 0;
+            keyball_on_custom_role(ball, x, y, r);
+        } break;
+        default:
+#if KEYBALL_GESTURE_ENABLE
+            if (keyball.gesture_armed) {
+                gesture_feed(m, ball);
+                break;
+            }
+#endif
+            motion_to_mouse_move(m, c, &b, ball);
+            break;
+    }
+    // add to the report, as both trackballs may have the same role.
+    r->x = clip2int8(r->x + b.x);
+    r->y = clip2int8(r->y + b.y);
+    r->h = clip2int8(r->h + b.h);
+    r->v = clip2int8(r->v + b.v);
+}
+
+#if KEYBALL_TYPING_GUARD_ENABLE
+static inline uint16_t motion_distance(keyball_motion_t *m) {
+    return abs(m->x) + abs(m->y);
+}
+
+// typing_guard discards small motion of trackballs while typing.
+static void typing_guard(uint32_t now) {
+    if (!keyball.typing_guard) {
+        return;
+    }
+    if (TIMER_DIFF_32(now, keyball.typing_guard_last) >= KEYBALL_TYPING_GUARD_TIME) {
+        keyball.typing_guard = false;
+        return;
+    }
+    uint16_t d = motion_distance(&keyball.this_motion) + motion_distance(&keyball.that_motion);
+    if (d == 0) {
+        return;
+    }
+    keyball.typing_guard_distance += d;
+    if (keyball.typing_guard_distance >= KEYBALL_TYPING_GUARD_THRESHOLD) {
+        // large motion is intentional, stop guarding.
+        keyball.typing_guard = false;
+        return;
+    }
+    keyball.typing_guard_count++;
+    keyball.typing_guard_discarded += d;
+    keyball.this_motion.x = 0;
+    keyball.this_motion.y = 0;
+    keyball.that_motion.x = 0;
+    keyball.that_motion.y = 0;
+}
+
+// typing_guard_arm starts to guard motion, when a pressed key is for typing.
+// Keys which switch layers or hold modifiers are used together with
+// trackballs, so they are ignored like auto mouse does.
+static void typing_guard_arm(uint16_t keycode, keyrecord_t *record) {
+    if (!record->event.pressed) {
+        return;
+    }
+    if (keycode >= QK_MODS && keycode <= QK_MODS_MAX) {
+        keycode &= 0xff;
+    }
+    if (IS_MOUSEKEY(keycode) || IS_MODIFIER_KEYCODE(keycode) || IS_QK_KB(keycode) || IS_QK_MOMENTARY(keycode) || IS_QK_TOGGLE_LAYER(keycode) || IS_QK_LAYER_TAP(keycode) || IS_QK_LAYER_MOD(keycode) || IS_QK_MOD_TAP(keycode) || IS_QK_ONE_SHOT_MOD(keycode) || IS_QK_ONE_SHOT_LAYER(keycode)) {
+        return;
+    }
+    keyball.typing_guard          = true;
+    keyball.typing_guard_last     = timer_read32();
+    keyball.typing_guard_distance = 0;
+}
+#endif
+
+#if KEYBALL_NOISE_GATE_ENABLE
+// noise_gate_feed updates a noise gate with arrival of new motion.  The gate
+// closes when motion arrives after the timeout, and residual jitter held in
+// the accumulator is discarded at that time.
+static void noise_gate_feed(keyball_motion_t *m, keyball_gate_t *g, uint32_t now) {
+    if (TIMER_DIFF_32(now, g->last) >= KEYBALL_NOISE_GATE_TIMEOUT) {
+        g->open = false;
+        m->x    = 0;
+        m->y    = 0;
+    }
+    g->last = now;
+}
+
+// noise_gate checks motion should pass to a mouse report or not.
+static bool noise_gate(keyball_motion_t *m, keyball_gate_t *g) {
+    if (!g->open && abs(m->x) + abs(m->y) >= KEYBALL_NOISE_GATE_THRESHOLD) {
+        g->open = true;
+    }
+    return g->open;
+}
+#endif
+
+#ifdef DEBUG_KEYBALL_REPORT_SKIP
+static void report_perf_task(bool built) {
+    static uint32_t timer = 0;
+    static uint32_t count[2];
+    count[built ? 1 : 0]++;
+    uint32_t now = timer_read32();
+    if (TIMER_DIFF_32(now, timer) > 1000) {
+#    if defined(CONSOLE_ENABLE)
+        dprintf("keyball:report: built=%lu skipped=%lu\n", count[1], count[0]);
+#    endif
+        count[0] = 0;
+        count[1] = 0;
+        timer    = now;
+    }
+}
+#endif
+
+#if defined(KEYBALL_SCROLLBALL_INHIVITOR) && KEYBALL_SCROLLBALL_INHIVITOR > 0
+// motion_ramp scales motion by gain (Q8).  The rest is dropped, not carried.
+static void motion_ramp(keyball_motion_t *m, int16_t g) {
+    m->x = (int32_t)m->x * g / 256;
+    m->y = (int32_t)m->y * g / 256;
+}
+#endif
+
+// motion_filter discards accumulated motion which shouldn't be reported.
+static void motion_filter(uint32_t now) {
+#if defined(KEYBALL_SCROLLBALL_INHIVITOR) && KEYBALL_SCROLLBALL_INHIVITOR > 0
+    // ramp motion in after change of scroll mode.
+    uint32_t elapsed = TIMER_DIFF_32(now, keyball.scroll_mode_changed);
+    if (elapsed < KEYBALL_SCROLLBALL_INHIVITOR) {
+        int16_t g = elapsed * 256 / KEYBALL_SCROLLBALL_INHIVITOR;
+        motion_ramp(&keyball.this_motion, g);
+        motion_ramp(&keyball.that_motion, g);
+    }
+#endif
+#if KEYBALL_TYPING_GUARD_ENABLE
+    typing_guard(now);
+#endif
+}
+
+static inline bool should_report(void) {
+    uint32_t now = timer_read32();
+#if defined(KEYBALL_REPORTMOUSE_INTERVAL) && KEYBALL_REPORTMOUSE_INTERVAL > 0
+    // throttling mouse report rate.
+    static uint32_t last = 0;
+    if (TIMER_DIFF_32(now, last) < KEYBALL_REPORTMOUSE_INTERVAL) {
+        return false;
+    }
+    last = now;
+#endif
+    motion_filter(now);
+    return true;
+}
+
+#if KEYBALL_SCROLL_COALESCE_ENABLE
+// scroll_coalesce holds wheel of a report without pointer motion, to send it
+// in fewer and larger reports.  Held wheel is sent with pointer motion too,
+// or when flush is true.
+static void scroll_coalesce(report_mouse_t *r, bool flush) {
+    bool    held = keyball.coalesce_h != 0 || keyball.coalesce_v != 0;
+    int16_t h    = add16(keyball.coalesce_h, r->h);
+    int16_t v    = add16(keyball.coalesce_v, r->v);
+    if (h == 0 && v == 0) {
+        keyball.coalesce_h = 0;
+        keyball.coalesce_v = 0;
+        r->h               = 0;
+        r->v               = 0;
+        return;
+    }
+    uint32_t now = timer_read32();
+    if (!held) {
+        keyball.coalesce_since = now;
+    }
+#if KEYBALL_ZOOM_PAN_ENABLE
+    // wheel for zoom is never held, not to be sent after its modifiers are
+    // released.
+    flush = flush || keyball.zoom_mods;
+#endif
+    if (!flush && r->x == 0 && r->y == 0 && abs(h) < KEYBALL_SCROLL_COALESCE_LIMIT && abs(v) < KEYBALL_SCROLL_COALESCE_LIMIT && TIMER_DIFF_32(now, keyball.coalesce_since) < KEYBALL_SCROLL_COALESCE_BUDGET) {
+        keyball.coalesce_h = h;
+        keyball.coalesce_v = v;
+        r->h               = 0;
+        r->v               = 0;
+        // keep report stages running to send held wheel in time.
+        keyball.motion_pending = true;
+        return;
+    }
+    r->h                   = clip2int8(h);
+    r->v                   = clip2int8(v);
+    keyball.coalesce_h     = h - r->h;
+    keyball.coalesce_v     = v - r->v;
+    keyball.coalesce_since = now;
+    if (keyball.coalesce_h != 0 || keyball.coalesce_v != 0) {
+        keyball.motion_pending = true;
+    }
 }
 #endif
 
-void pointing_device_driver_init(void) {
-#if KEYBALL_MODEL != 46
-    keyball.this_have_ball = pmw3360_init();
+// motion_to_report moves all pending motion to a mouse report.  flush is
+// true when the report must carry all held wheel.
+static void motion_to_report(report_mouse_t *rep, bool flush) {
+    keyball.motion_pending = false;
+#if KEYBALL_NOISE_GATE_ENABLE
+    if (noise_gate(&keyball.this_motion, &keyball.this_gate)) {
+        motion_to_mouse(KEYBALL_BALL_THIS, rep);
+    }
+    if (noise_gate(&keyball.that_motion, &keyball.that_gate)) {
+        motion_to_mouse(KEYBALL_BALL_THAT, rep);
+    }
+#else
+    motion_to_mouse(KEYBALL_BALL_THIS, rep);
+    motion_to_mouse(KEYBALL_BALL_THAT, rep);
 #endif
-    if (keyball.this_have_ball) {
-        pmw3360_cpi_set(CPI_DEFAULT - 1);
-        pmw3360_reg_write(pmw3360_Motion_Burst, 0);
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    // feed the pointer after the typing guard and the noise gate, not to turn
+    // on the layer by motion which is never reported.
+    if (rep->x != 0 || rep->y != 0) {
+        auto_mouse_motion(rep->x, rep->y);
     }
+#endif
+#if KEYBALL_SCROLL_COALESCE_ENABLE
+    scroll_coalesce(rep, flush);
+#endif
+    // store mouse report for OLED.
+    keyball.last_mouse = *rep;
 }
 
-uint16_t pointing_device_driver_get_cpi(void) {
-    return keyball_get_cpi();
+//////////////////////////////////////////////////////////////////////////////
+// Kinetic scroll
+
+#if KEYBALL_KINETIC_SCROLL_ENABLE
+// screen_to_motion converts motion on screen axes to a sensor, reverse of
+// motion_to_screen().
+static void screen_to_motion(int16_t x, int16_t y, keyball_ball_t ball, keyball_motion_t *m) {
+    keyball_axis_map_t a = keyball.topo.axis[ball];
+    x                    = a.neg_x ? -x : x;
+    y                    = a.neg_y ? -y : y;
+    m->x                 = a.swap ? y : x;
+    m->y                 = a.swap ? x : y;
 }
 
-void pointing_device_driver_set_cpi(uint16_t cpi) {
-    keyball_set_cpi(cpi);
+static void kinetic_cancel(void) {
+    keyball.kinetic_armed  = false;
+    keyball.kinetic_active = false;
 }
 
-static void motion_to_mouse_move(keyball_motion_t *m, report_mouse_t *r, bool is_left) {
-#if KEYBALL_MODEL == 61 || KEYBALL_MODEL == 39 || KEYBALL_MODEL == 147 || KEYBALL_MODEL == 44
-    r->x = clip2int8(m->y);
-    r->y = clip2int8(m->x);
-    if (is_left) {
-        r->x = -r->x;
-        r->y = -r->y;
+// kinetic_motion handles arrival of real motion.  Momentum stops, and
+// release of a trackball is waited while it scrolls.
+static void kinetic_motion(keyball_ball_t ball) {
+    keyball.kinetic_active = false;
+    keyball.kinetic_armed  = ball_role(ball) == KEYBALL_ROLE_SCROLL;
+    keyball.kinetic_ball   = ball;
+    keyball.kinetic_last   = timer_read32();
+}
+
+// kinetic_friction returns friction with the active profile applied.
+static uint8_t kinetic_friction(void) {
+#    if KEYBALL_PROFILE_ENABLE
+    if (keyball.profile.friction != 0) {
+        return keyball.profile.friction;
     }
-#elif KEYBALL_MODEL == 46
-    r->x = clip2int8(m->x);
-    r->y = -clip2int8(m->y);
-#else
-#    error("unknown Keyball model")
-#endif
-    // clear motion
-    m->x = 0;
-    m->y = 0;
+#    endif
+    return KEYBALL_KINETIC_SCROLL_FRICTION;
 }
 
-static void motion_to_mouse_scroll(keyball_motion_t *m, report_mouse_t *r, bool is_left) {
-    // consume motion of trackball.
-    uint8_t div = keyball_get_scroll_div() - 1;
-    int16_t x   = m->x >> div;
-    m->x -= x << div;
-    int16_t y = m->y >> div;
-    m->y -= y << div;
+// kinetic_decay applies friction to velocity.  It loses 1 at least, so that
+// small velocity stops surely.
+static int16_t kinetic_decay(int16_t v, uint8_t friction) {
+    int16_t d = (int32_t)v * friction / 256;
+    if (d == 0) {
+        d = v > 0 ? 1 : v < 0 ? -1 : 0;
+    }
+    return v - d;
+}
 
-    // apply to mouse report.
-#if KEYBALL_MODEL == 61 || KEYBALL_MODEL == 39 || KEYBALL_MODEL == 147 || KEYBALL_MODEL == 44
-    r->h = clip2int8(y);
-    r->v = -clip2int8(x);
-    if (is_left) {
-        r->h = -r->h;
-        r->v = -r->v;
+// kinetic_start starts momentum with release velocity.  It is estimated over
+// the window which ends at the last sample, to exclude the idle time for
+// detecting release.
+static void kinetic_start(void) {
+    keyball_history_t *h = get_history(keyball.kinetic_ball);
+    if (h->count == 0) {
+        return;
     }
-#elif KEYBALL_MODEL == 46
-    r->h = clip2int8(x);
-    r->v = clip2int8(y);
-#else
-#    error("unknown Keyball model")
-#endif
+    keyball_velocity_t v = history_velocity(h, history_at(h, 0)->time);
+    int32_t            x = (int32_t)v.x * KEYBALL_KINETIC_SCROLL_INTERVAL;
+    int32_t            y = (int32_t)v.y * KEYBALL_KINETIC_SCROLL_INTERVAL;
+    if (labs(x) + labs(y) < KEYBALL_KINETIC_SCROLL_THRESHOLD * 256L) {
+        return;
+    }
+    keyball.kinetic_x      = x < -32767 ? -32767 : x > 32767 ? 32767 : x;
+    keyball.kinetic_y      = y < -32767 ? -32767 : y > 32767 ? 32767 : y;
+    keyball.kinetic_carry  = (keyball_motion_t){0};
+    keyball.kinetic_active = true;
+}
 
-#if KEYBALL_SCROLLSNAP_ENABLE
-    // scroll snap.
+// kinetic_task feeds momentum to motion of the trackball as if it moves, so
+// that it is scrolled by the same way (divider, snap and so on).
+static void kinetic_task(void) {
     uint32_t now = timer_read32();
-    if (r->h != 0 || r->v != 0) {
-        keyball.scroll_snap_last = now;
-    } else if (TIMER_DIFF_32(now, keyball.scroll_snap_last) >= KEYBALL_SCROLLSNAP_RESET_TIMER) {
-        keyball.scroll_snap_tension_h = 0;
+    if (keyball.kinetic_armed) {
+        if (TIMER_DIFF_32(now, keyball.kinetic_last) >= KEYBALL_KINETIC_SCROLL_RELEASE) {
+            keyball.kinetic_armed = false;
+            keyball.kinetic_last  = now;
+            kinetic_start();
+        }
+        return;
     }
-    if (abs(keyball.scroll_snap_tension_h) < KEYBALL_SCROLLSNAP_TENSION_THRESHOLD) {
-        keyball.scroll_snap_tension_h += y;
-        r->h = 0;
+    if (!keyball.kinetic_active || TIMER_DIFF_32(now, keyball.kinetic_last) < KEYBALL_KINETIC_SCROLL_INTERVAL) {
+        return;
     }
-#endif
+    keyball.kinetic_last = now;
+    keyball_ball_t ball  = keyball.kinetic_ball;
+    if (ball_role(ball) != KEYBALL_ROLE_SCROLL || (keyball.kinetic_x == 0 && keyball.kinetic_y == 0)) {
+        kinetic_cancel();
+        return;
+    }
+    int16_t x = fixq8(keyball.kinetic_x, &keyball.kinetic_carry.x);
+    int16_t y = fixq8(keyball.kinetic_y, &keyball.kinetic_carry.y);
+    if (x != 0 || y != 0) {
+        keyball_motion_t d;
+        screen_to_motion(x, y, ball, &d);
+        keyball_motion_t *m    = ball == KEYBALL_BALL_THAT ? &keyball.that_motion : &keyball.this_motion;
+        m->x                   = add16(m->x, d.x);
+        m->y                   = add16(m->y, d.y);
+        keyball.motion_pending = true;
+    }
+    uint8_t f         = kinetic_friction();
+    keyball.kinetic_x = kinetic_decay(keyball.kinetic_x, f);
+    keyball.kinetic_y = kinetic_decay(keyball.kinetic_y, f);
 }
+#endif
 
-static void motion_to_mouse(keyball_motion_t *m, report_mouse_t *r, bool is_left, bool as_scroll) {
-    if (as_scroll) {
-        motion_to_mouse_scroll(m, r, is_left);
-    } else {
-        motion_to_mouse_move(m, r, is_left);
+// pointer_motion notifies arrival of motion to features which follow motion
+// of trackballs.
+static inline void pointer_motion(keyball_ball_t ball) {
+#if KEYBALL_KINETIC_SCROLL_ENABLE
+    kinetic_motion(ball);
+#endif
+#if KEYBALL_DRAG_LOCK_ENABLE
+    if (ball_role(ball) != KEYBALL_ROLE_POINTER) {
+        return;
     }
+    drag_lock_motion();
+#endif
 }
 
-static inline bool should_report(void) {
-    uint32_t now = timer_read32();
-#if defined(KEYBALL_REPORTMOUSE_INTERVAL) && KEYBALL_REPORTMOUSE_INTERVAL > 0
-    // throttling mouse report rate.
-    static uint32_t last = 0;
-    if (TIMER_DIFF_32(now, last) < KEYBALL_REPORTMOUSE_INTERVAL) {
-        return false;
-    }
-    last = now;
+// motion_consume moves motion of the sensor from the ring to the accumulator.
+// Rotation is applied here, only on the primary, as the secondary sends raw
+// samples which are rotated in rpc_get_motion_invoke.
+static void motion_consume(void) {
+    keyball_sample_t s;
+    while (motion_ring_pop(&keyball.this_ring, &s)) {
+#if KEYBALL_ROTATION_ENABLE
+        rotate_motion(&s.x, &s.y, &keyball.this_rot_carry);
 #endif
-#if defined(KEYBALL_SCROLLBALL_INHIVITOR) && KEYBALL_SCROLLBALL_INHIVITOR > 0
-    if (TIMER_DIFF_32(now, keyball.scroll_mode_changed) < KEYBALL_SCROLLBALL_INHIVITOR) {
-        keyball.this_motion.x = 0;
-        keyball.this_motion.y = 0;
-        keyball.that_motion.x = 0;
-        keyball.that_motion.y = 0;
-    }
+#if KEYBALL_HISTORY_ENABLE
+        int16_t hx, hy;
+        motion_to_screen(&(keyball_motion_t){.x = s.x, .y = s.y}, KEYBALL_BALL_THIS, &hx, &hy);
+        history_add(&keyball.this_history, hx, hy, s.time);
 #endif
-    return true;
+#if KEYBALL_NOISE_GATE_ENABLE
+        noise_gate_feed(&keyball.this_motion, &keyball.this_gate, timer_read32());
+#endif
+        keyball.this_motion.x  = add16(keyball.this_motion.x, s.x);
+        keyball.this_motion.y  = add16(keyball.this_motion.y, s.y);
+        keyball.motion_pending = true;
+        pointer_motion(KEYBALL_BALL_THIS);
+    }
 }
 
 report_mouse_t pointing_device_driver_get_report(report_mouse_t rep) {
     // fetch from optical sensor.
     if (keyball.this_have_ball) {
         pmw3360_motion_t d = {0};
-        if (pmw3360_motion_burst(&d)) {
-            ATOMIC_BLOCK_FORCEON {
-                keyball.this_motion.x = add16(keyball.this_motion.x, d.x);
-                keyball.this_motion.y = add16(keyball.this_motion.y, d.y);
-            }
+        if (pmw3360_motion_burst(&d) && (d.x != 0 || d.y != 0)) {
+            motion_ring_push(&keyball.this_ring, d.x, d.y);
+        } else {
+            motion_ring_flush(&keyball.this_ring);
+        }
+    }
+    if (!is_keyboard_master()) {
+        return rep;
+    }
+    motion_consume();
+    // skip all stages when nothing happened.
+    if (!keyball.motion_pending) {
+        // clear mouse report for OLED, only once after motion.
+        if (keyball.last_mouse.x != 0 || keyball.last_mouse.y != 0 || keyball.last_mouse.h != 0 || keyball.last_mouse.v != 0) {
+            keyball.last_mouse = rep;
         }
+#ifdef DEBUG_KEYBALL_REPORT_SKIP
+        report_perf_task(false);
+#endif
+        return rep;
     }
     // report mouse event, if keyboard is primary.
-    if (is_keyboard_master() && should_report()) {
+    if (should_report()) {
         // modify mouse report by PMW3360 motion.
-        motion_to_mouse(&keyball.this_motion, &rep, is_keyboard_left(), keyball.scroll_mode);
-        motion_to_mouse(&keyball.that_motion, &rep, !is_keyboard_left(), keyball.scroll_mode ^ keyball.this_have_ball);
-        // store mouse report for OLED.
-        keyball.last_mouse = rep;
+        motion_to_report(&rep, false);
+#ifdef DEBUG_KEYBALL_REPORT_SKIP
+        report_perf_task(true);
+#endif
     }
     return rep;
 }
 
+// keyball_send_button sends a change of mouse button immediately, without
+// waiting for throttled mouse report.  Pending motion is sent together, so
+// the click lands where the pointer is.
+void keyball_send_button(uint8_t btn, bool pressed) {
+    report_mouse_t rep  = pointing_device_get_report();
+    uint8_t        mask = 1 << (btn & 7);
+    rep.buttons         = pressed ? (rep.buttons | mask) : (rep.buttons & ~mask);
+    motion_consume();
+    if (keyball.motion_pending) {
+        motion_filter(timer_read32());
+        motion_to_report(&rep, true);
+    }
+    pointing_device_set_report(rep);
+    pointing_device_send();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Split RPC
 
@@ -285,7 +1555,7 @@ static void rpc_get_info_invoke(void) {
 
 #    ifdef VIA_ENABLE
     // adjust VIA layout options according to current combination.
-    uint8_t  layouts = (keyball.this_have_ball ? (is_keyboard_left() ? 0x02 : 0x01) : 0x00) | (keyball.that_have_ball ? (is_keyboard_left() ? 0x01 : 0x02) : 0x00);
+    uint8_t  layouts = (keyball.this_have_ball ? (keyball.topo.is_left ? 0x02 : 0x01) : 0x00) | (keyball.that_have_ball ? (keyball.topo.is_left ? 0x01 : 0x02) : 0x00);
     uint32_t curr    = via_get_layout_options();
     uint32_t next    = (curr & ~0x3) | layouts;
     if (next != curr) {
@@ -297,10 +1567,14 @@ static void rpc_get_info_invoke(void) {
 }
 
 static void rpc_get_motion_handler(uint8_t in_buflen, const void *in_data, uint8_t out_buflen, void *out_data) {
-    *(keyball_motion_t *)out_data = keyball.this_motion;
-    // clear motion
-    keyball.this_motion.x = 0;
-    keyball.this_motion.y = 0;
+    // consume motion of the sensor.
+    keyball_motion_t m = {0};
+    keyball_sample_t s;
+    while (motion_ring_pop(&keyball.this_ring, &s)) {
+        m.x = add16(m.x, s.x);
+        m.y = add16(m.y, s.y);
+    }
+    *(keyball_motion_t *)out_data = m;
 }
 
 static void rpc_get_motion_invoke(void) {
@@ -310,9 +1584,22 @@ static void rpc_get_motion_invoke(void) {
         return;
     }
     keyball_motion_t recv = {0};
-    if (transaction_rpc_exec(KEYBALL_GET_MOTION, 0, NULL, sizeof(recv), &recv)) {
-        keyball.that_motion.x = add16(keyball.that_motion.x, recv.x);
-        keyball.that_motion.y = add16(keyball.that_motion.y, recv.y);
+    if (transaction_rpc_exec(KEYBALL_GET_MOTION, 0, NULL, sizeof(recv), &recv) && (recv.x != 0 || recv.y != 0)) {
+#    if KEYBALL_ROTATION_ENABLE
+        rotate_motion(&recv.x, &recv.y, &keyball.that_rot_carry);
+#    endif
+#    if KEYBALL_HISTORY_ENABLE
+        int16_t hx, hy;
+        motion_to_screen(&recv, KEYBALL_BALL_THAT, &hx, &hy);
+        history_add(&keyball.that_history, hx, hy, timer_read32());
+#    endif
+#    if KEYBALL_NOISE_GATE_ENABLE
+        noise_gate_feed(&keyball.that_motion, &keyball.that_gate, now);
+#    endif
+        keyball.that_motion.x  = add16(keyball.that_motion.x, recv.x);
+        keyball.that_motion.y  = add16(keyball.that_motion.y, recv.y);
+        keyball.motion_pending = true;
+        pointer_motion(KEYBALL_BALL_THAT);
     }
     last_sync = now;
     return;
@@ -326,7 +1613,7 @@ static void rpc_set_cpi_invoke(void) {
     if (!keyball.cpi_changed) {
         return;
     }
-    keyball_cpi_t req = keyball.cpi_value;
+    keyball_cpi_t req = keyball.cpi_applied;
     if (!transaction_rpc_send(KEYBALL_SET_CPI, sizeof(req), &req)) {
         return;
     }
@@ -367,11 +1654,11 @@ void keyball_oled_render_ballinfo(void) {
     oled_write(format_4d(keyball.last_mouse.v), false);
     // CPI
     oled_write_P(PSTR("     CPI"), false);
-    oled_write(format_4d(keyball_get_cpi()) + 1, false);
+    oled_write(format_4d(effective_cpi()) + 1, false);
     oled_write_P(PSTR("00  S"), false);
     oled_write_char(keyball.scroll_mode ? '1' : '0', false);
     oled_write_P(PSTR("  D"), false);
-    oled_write_char('0' + keyball_get_scroll_div(), false);
+    oled_write_char('0' + effective_scroll_div(), false);
 #endif
 }
 
@@ -431,9 +1718,63 @@ bool keyball_get_scroll_mode(void) {
     return keyball.scroll_mode;
 }
 
+bool keyball_get_auto_mouse_layer_enable(void) {
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    return keyball.aml_enable;
+#else
+    return false;
+#endif
+}
+
+void keyball_set_auto_mouse_layer_enable(bool enable) {
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    if (!enable) {
+        auto_mouse_off();
+    }
+    keyball.aml_enable = enable;
+#endif
+}
+
+keyball_role_t keyball_get_role(keyball_ball_t ball) {
+    return ball == KEYBALL_BALL_THIS ? keyball.this_role : keyball.that_role;
+}
+
+void keyball_set_role(keyball_ball_t ball, keyball_role_t role) {
+    if (role >= KEYBALL_ROLE_COUNT) {
+        role = KEYBALL_ROLE_AUTO;
+    }
+    if (ball == KEYBALL_BALL_THIS) {
+        keyball.this_role = role;
+        keyball.this_keys = 0;
+    } else {
+        keyball.that_role = role;
+        keyball.that_keys = 0;
+    }
+}
+
+bool keyball_get_arrow_mode(void) {
+#if KEYBALL_ARROW_ENABLE
+    return keyball.arrow_mode;
+#else
+    return false;
+#endif
+}
+
+void keyball_set_arrow_mode(bool mode) {
+#if KEYBALL_ARROW_ENABLE
+    arrow_reset();
+    keyball.arrow_mode = mode;
+#endif
+}
+
 void keyball_set_scroll_mode(bool mode) {
     if (mode != keyball.scroll_mode) {
         keyball.scroll_mode_changed = timer_read32();
+#if defined(KEYBALL_SCROLLBALL_INHIVITOR) && KEYBALL_SCROLLBALL_INHIVITOR > 0
+        // drop motion for the previous mode.
+        keyball.this_motion = (keyball_motion_t){0};
+        keyball.that_motion = (keyball_motion_t){0};
+#endif
     }
     keyball.scroll_mode = mode;
 }
@@ -446,6 +1787,31 @@ void keyball_set_scroll_div(uint8_t div) {
     keyball.scroll_div = div > SCROLL_DIV_MAX ? SCROLL_DIV_MAX : div;
 }
 
+uint8_t keyball_get_scroll_div_frac(void) {
+    return keyball.scroll_div_frac;
+}
+
+void keyball_set_scroll_div_frac(uint8_t frac) {
+    keyball.scroll_div_frac = frac > 3 ? 3 : frac;
+}
+
+keyball_scrollsnap_mode_t keyball_get_scrollsnap_mode(void) {
+#if KEYBALL_SCROLLSNAP_ENABLE
+    return keyball.scroll_snap_mode;
+#else
+    return KEYBALL_SCROLLSNAP_MODE_FREE;
+#endif
+}
+
+void keyball_set_scrollsnap_mode(keyball_scrollsnap_mode_t mode) {
+#if KEYBALL_SCROLLSNAP_ENABLE
+    keyball.scroll_snap_mode    = mode > KEYBALL_SCROLLSNAP_MODE_FREE ? KEYBALL_SCROLLSNAP_MODE_AUTO : mode;
+    keyball.scroll_snap_decided = false;
+    keyball.scroll_snap_x       = 0;
+    keyball.scroll_snap_y       = 0;
+#endif
+}
+
 uint8_t keyball_get_cpi(void) {
     return keyball.cpi_value == 0 ? CPI_DEFAULT : keyball.cpi_value;
 }
@@ -454,17 +1820,101 @@ void keyball_set_cpi(uint8_t cpi) {
     if (cpi > CPI_MAX) {
         cpi = CPI_MAX;
     }
-    keyball.cpi_value   = cpi;
-    keyball.cpi_changed = true;
-    if (keyball.this_have_ball) {
-        pmw3360_cpi_set(cpi == 0 ? CPI_DEFAULT - 1 : cpi - 1);
-        pmw3360_reg_write(pmw3360_Motion_Burst, 0);
+    keyball.cpi_value = cpi;
+    sync_cpi();
+}
+
+uint8_t keyball_get_scale_x(void) {
+    return keyball.scale_x == 0 ? SCALE_DEFAULT : keyball.scale_x;
+}
+
+void keyball_set_scale_x(uint8_t scale) {
+    keyball.scale_x = scale > SCALE_MAX ? SCALE_MAX : scale;
+}
+
+uint8_t keyball_get_scale_y(void) {
+    return keyball.scale_y == 0 ? SCALE_DEFAULT : keyball.scale_y;
+}
+
+void keyball_set_scale_y(uint8_t scale) {
+    keyball.scale_y = scale > SCALE_MAX ? SCALE_MAX : scale;
+}
+
+uint16_t keyball_get_rotation(void) {
+#if KEYBALL_ROTATION_ENABLE
+    return keyball.rotation;
+#else
+    return 0;
+#endif
+}
+
+void keyball_set_rotation(int16_t deg) {
+#if KEYBALL_ROTATION_ENABLE
+    deg %= 360;
+    if (deg < 0) {
+        deg += 360;
+    }
+    keyball.rotation       = deg;
+    keyball.this_rot_carry = (keyball_motion_t){0};
+    keyball.that_rot_carry = (keyball_motion_t){0};
+#endif
+}
+
+keyball_velocity_t keyball_get_velocity(keyball_ball_t ball) {
+#if KEYBALL_HISTORY_ENABLE
+    return history_velocity(get_history(ball), timer_read32());
+#else
+    return (keyball_velocity_t){0};
+#endif
+}
+
+bool keyball_get_history(keyball_ball_t ball, uint8_t index, keyball_sample_t *sample) {
+#if KEYBALL_HISTORY_ENABLE
+    keyball_history_t *h = get_history(ball);
+    if (index < h->count) {
+        *sample = *history_at(h, index);
+        return true;
+    }
+#endif
+    return false;
+}
+
+void keyball_apply_profile(const keyball_profile_t *profile) {
+#if KEYBALL_PROFILE_ENABLE
+    keyball.profile = *profile;
+    if (keyball.profile.cpi > CPI_MAX) {
+        keyball.profile.cpi = CPI_MAX;
+    }
+    if (keyball.profile.sdiv > SCROLL_DIV_MAX) {
+        keyball.profile.sdiv = SCROLL_DIV_MAX;
     }
+    sync_cpi();
+#endif
 }
 
 //////////////////////////////////////////////////////////////////////////////
 // Keyboard hooks
 
+#if KEYBALL_PROFILE_ENABLE
+// profile_sync applies the profile for the highest layer.  A host profile is
+// applied while the layer has no profile.
+static void profile_sync(layer_state_t state) {
+    keyball_profile_t p = {0};
+#    if KEYBALL_LAYER_PROFILE_ENABLE
+    uint8_t layer = get_highest_layer(state);
+    if (layer < KEYBALL_LAYER_PROFILE_COUNT) {
+        memcpy_P(&p, &keyball_layer_profiles[layer], sizeof(p));
+    }
+#    endif
+#    if KEYBALL_HOST_PROFILE_ENABLE
+    if (keyball.host_profile != 0 && memcmp(&p, &(keyball_profile_t){0}, sizeof(p)) == 0) {
+        memcpy_P(&p, &keyball_host_profiles[keyball.host_profile - 1], sizeof(p));
+    }
+#    endif
+    keyball_apply_profile(&p);
+}
+#endif
+
 void keyboard_post_init_kb(void) {
 #ifdef SPLIT_KEYBOARD
     // register transaction handlers on secondary.
@@ -477,23 +1927,118 @@ void keyboard_post_init_kb(void) {
 
     // read keyball configuration from EEPROM
     if (eeconfig_is_enabled()) {
+#if EECONFIG_KB_DATA_SIZE > 0
+        keyball_eeconfig_t ee = {0};
+        if (eeconfig_is_kb_datablock_valid()) {
+            eeconfig_read_kb_datablock(&ee);
+        } else {
+            // migrate configuration which older firmwares stored in kb dword.
+            ee.config.raw = eeconfig_read_kb();
+        }
+        keyball_config_t c = ee.config;
+#else
         keyball_config_t c = {.raw = eeconfig_read_kb()};
+#endif
         keyball_set_cpi(c.cpi);
         keyball_set_scroll_div(c.sdiv);
+        keyball_set_scale_x(c.scx);
+        keyball_set_scale_y(c.scy);
+        keyball_set_rotation(c.rot);
+        keyball_set_scrollsnap_mode(c.ssnp);
+#if EECONFIG_KB_DATA_SIZE > 0
+        keyball_set_role(KEYBALL_BALL_THIS, ee.ext.this_role);
+        keyball_set_role(KEYBALL_BALL_THAT, ee.ext.that_role);
+        keyball_set_scroll_div_frac(ee.ext.sdiv_frac);
+#endif
     }
+#if KEYBALL_PROFILE_ENABLE
+    // layer_state_set_kb isn't called until a layer changes, so apply the
+    // profile of the default layer at boot.
+    if (is_keyboard_master()) {
+        profile_sync(layer_state);
+    }
+#endif
+    // push CPI to the secondary once, even when it is same as applied one.
+    keyball.cpi_changed = true;
 
     keyball_on_adjust_layout(KEYBALL_ADJUST_PENDING);
     keyboard_post_init_user();
 }
 
-#if SPLIT_KEYBOARD
+#if KEYBALL_LAYER_PROFILE_ENABLE
+layer_state_t layer_state_set_kb(layer_state_t state) {
+    state = layer_state_set_user(state);
+    if (is_keyboard_master()) {
+        profile_sync(state);
+    }
+    return state;
+}
+#endif
+
+#if KEYBALL_HOST_PROFILE_ENABLE
+bool keyball_raw_command(uint8_t *data, uint8_t length) {
+    if (length < 4 || data[0] != KEYBALL_RAW_ID) {
+        return false;
+    }
+    uint8_t status = 0;
+    switch (data[1]) {
+        case KEYBALL_RAW_SET_PROFILE:
+            if (data[2] > KEYBALL_HOST_PROFILE_COUNT) {
+                status = 1;
+                break;
+            }
+            keyball.host_profile = data[2];
+            profile_sync(layer_state);
+            break;
+        case KEYBALL_RAW_GET_PROFILE:
+            break;
+        default:
+            status = 1;
+            break;
+    }
+    data[2] = status;
+    data[3] = keyball.host_profile;
+    raw_hid_send(data, length);
+    return true;
+}
+
+#    ifdef VIA_ENABLE
+bool via_command_kb(uint8_t *data, uint8_t length) {
+    return keyball_raw_command(data, length);
+}
+#    else
+// weak, so that a keymap can define its own and call keyball_raw_command().
+__attribute__((weak)) void raw_hid_receive(uint8_t *data, uint8_t length) {
+    keyball_raw_command(data, length);
+}
+#    endif
+#endif
+
+#if SPLIT_KEYBOARD || KEYBALL_AUTO_MOUSE_ENABLE || KEYBALL_ARROW_ENABLE || KEYBALL_DRAG_LOCK_ENABLE || KEYBALL_KINETIC_SCROLL_ENABLE || KEYBALL_ZOOM_PAN_ENABLE
 void housekeeping_task_kb(void) {
     if (is_keyboard_master()) {
+#    if SPLIT_KEYBOARD
         rpc_get_info_invoke();
         if (keyball.that_have_ball) {
             rpc_get_motion_invoke();
             rpc_set_cpi_invoke();
         }
+#    endif
+#    if KEYBALL_AUTO_MOUSE_ENABLE
+        auto_mouse_task();
+#    endif
+#    if KEYBALL_ARROW_ENABLE
+        arrow_task();
+#    endif
+#    if KEYBALL_DRAG_LOCK_ENABLE
+        drag_lock_task();
+#    endif
+#    if KEYBALL_KINETIC_SCROLL_ENABLE
+        kinetic_task();
+#    endif
+#    if KEYBALL_ZOOM_PAN_ENABLE
+        zoom_task();
+#    endif
     }
 }
 #endif
@@ -503,6 +2048,21 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
     keyball.last_kc  = keycode;
     keyball.last_pos = record->event.key;
 
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    auto_mouse_process(keycode, record);
+#endif
+#if KEYBALL_TYPING_GUARD_ENABLE
+    // arm before the user's hook, which may consume keys for typing.
+    typing_guard_arm(keycode, record);
+#endif
+#if KEYBALL_ZOOM_PAN_ENABLE
+    // modifiers for zoom must not leak into a key, so that it is sent
+    // without them before anything processes it.
+    if (record->event.pressed) {
+        zoom_release();
+    }
+#endif
+
     if (!process_record_user(keycode, record)) {
         return false;
     }
@@ -512,21 +2072,52 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
         keycode &= 0xff;
     }
 
+#if KEYBALL_KINETIC_SCROLL_ENABLE
+    if (record->event.pressed) {
+        kinetic_cancel();
+    }
+#endif
+#if KEYBALL_DRAG_LOCK_ENABLE
+    // a mouse button ends drag lock, even when mouse keys process it.
+    if (record->event.pressed && keycode >= KC_MS_BTN1 && keycode <= KC_MS_BTN8) {
+        drag_lock_press(keycode - KC_MS_BTN1);
+    }
+#endif
+
     switch (keycode) {
 #ifndef MOUSEKEY_ENABLE
         // process KC_MS_BTN1~8 by myself
         // See process_action() in quantum/action.c for details.
-        case KC_MS_BTN1 ... KC_MS_BTN8: {
-            extern void register_mouse(uint8_t mouse_keycode, bool pressed);
-            register_mouse(keycode, record->event.pressed);
+        case KC_MS_BTN1 ... KC_MS_BTN8:
+            keyball_send_button(keycode - KC_MS_BTN1, record->event.pressed);
             // to apply QK_MODS actions, allow to process others.
             return true;
-        }
 #endif
 
         case SCRL_MO:
             keyball_set_scroll_mode(record->event.pressed);
             return false;
+
+        case ARRW_MO:
+            keyball_set_arrow_mode(record->event.pressed);
+            return false;
+
+        case GES_ARM:
+#if KEYBALL_GESTURE_ENABLE
+            gesture_arm(record->event.pressed);
+#endif
+            return false;
+
+        case ZOOM_MO:
+#if KEYBALL_ZOOM_PAN_ENABLE
+            wheel_role_set(KEYBALL_ROLE_ZOOM, record->event.pressed);
+#endif
+            return false;
+        case PAN_MO:
+#if KEYBALL_ZOOM_PAN_ENABLE
+            wheel_role_set(KEYBALL_ROLE_PAN, record->event.pressed);
+#endif
+            return false;
     }
 
     // process events which works on pressed only.
@@ -535,13 +2126,38 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
             case KBC_RST:
                 keyball_set_cpi(0);
                 keyball_set_scroll_div(0);
+                keyball_set_scroll_div_frac(0);
+                keyball_set_scale_x(0);
+                keyball_set_scale_y(0);
+                keyball_set_rotation(0);
+                keyball_set_scrollsnap_mode(KEYBALL_SCROLLSNAP_MODE_AUTO);
+                keyball_set_role(KEYBALL_BALL_THIS, KEYBALL_ROLE_AUTO);
+                keyball_set_role(KEYBALL_BALL_THAT, KEYBALL_ROLE_AUTO);
                 break;
             case KBC_SAVE: {
                 keyball_config_t c = {
                     .cpi  = keyball.cpi_value,
                     .sdiv = keyball.scroll_div,
+                    .scx  = keyball.scale_x,
+                    .rot  = keyball_get_rotation(),
+                    .scy  = keyball.scale_y,
+                    .ssnp = keyball_get_scrollsnap_mode(),
                 };
+#if EECONFIG_KB_DATA_SIZE > 0
+                // kb dword holds version of the datablock, so don't write it.
+                keyball_eeconfig_t ee = {
+                    .config = c,
+                    .ext =
+                        {
+                            .this_role = keyball.this_role,
+                            .that_role = keyball.that_role,
+                            .sdiv_frac = keyball.scroll_div_frac,
+                        },
+                };
+                eeconfig_update_kb_datablock(&ee);
+#else
                 eeconfig_update_kb(c.raw);
+#endif
             } break;
 
             case CPI_I100:
@@ -560,12 +2176,67 @@ bool process_record_kb(uint16_t keycode, keyrecord_t *record) {
             case SCRL_TO:
                 keyball_set_scroll_mode(!keyball.scroll_mode);
                 break;
+            case ARRW_TO:
+                keyball_set_arrow_mode(!keyball_get_arrow_mode());
+                break;
+
+            case SSNP_VRT:
+                keyball_set_scrollsnap_mode(KEYBALL_SCROLLSNAP_MODE_VERTICAL);
+                break;
+            case SSNP_HOR:
+                keyball_set_scrollsnap_mode(KEYBALL_SCROLLSNAP_MODE_HORIZONTAL);
+                break;
+            case SSNP_FRE:
+                keyball_set_scrollsnap_mode(KEYBALL_SCROLLSNAP_MODE_FREE);
+                break;
+            case SSNP_AUT:
+                keyball_set_scrollsnap_mode(KEYBALL_SCROLLSNAP_MODE_AUTO);
+                break;
+
+            case DRG_LCK:
+                keyball_toggle_drag_lock(0, false);
+                break;
+            case CLK_HLD:
+                keyball_toggle_drag_lock(0, true);
+                break;
             case SCRL_DVI:
                 add_scroll_div(1);
                 break;
             case SCRL_DVD:
                 add_scroll_div(-1);
                 break;
+            case SCRL_DFI:
+                add_scroll_div_frac(1);
+                break;
+            case SCRL_DFD:
+                add_scroll_div_frac(-1);
+                break;
+
+            case SCX_I:
+                add_scale_x(1);
+                break;
+            case SCX_D:
+                add_scale_x(-1);
+                break;
+            case SCY_I:
+                add_scale_y(1);
+                break;
+            case SCY_D:
+                add_scale_y(-1);
+                break;
+
+            case ROT_I1:
+                add_rotation(1);
+                break;
+            case ROT_D1:
+                add_rotation(-1);
+                break;
+            case ROT_I15:
+                add_rotation(15);
+                break;
+            case ROT_D15:
+                add_rotation(-15);
+                break;
 
             default:
                 return true;
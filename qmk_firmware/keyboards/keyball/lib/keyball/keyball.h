@@ -32,10 +32,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #    define KEYBALL_REPORTMOUSE_INTERVAL 8 // mouse report rate: 125Hz
 #endif
 
+/// KEYBALL_SCROLLBALL_INHIVITOR is time in ms to ramp motion in after change
+/// of scroll mode.  Motion which is not reported yet at the change is dropped,
+/// and then output grows from zero to full in this time, not to jerk pointer
+/// or scroll by motion meant for the previous mode.
 #ifndef KEYBALL_SCROLLBALL_INHIVITOR
 #    define KEYBALL_SCROLLBALL_INHIVITOR 50
 #endif
 
+/// KEYBALL_SCROLLSNAP_ENABLE enables scroll snap, which locks scroll to an
+/// axis by keyball_scrollsnap_mode_t.  In auto mode, the axis is decided when
+/// motion reaches KEYBALL_SCROLLSNAP_THRESHOLD counts after idle of
+/// KEYBALL_SCROLLSNAP_RESET_TIMER ms.  Scroll is locked when its direction is
+/// within KEYBALL_SCROLLSNAP_LOCK_ANGLE degrees from an axis, and unlocked
+/// when it goes out of KEYBALL_SCROLLSNAP_UNLOCK_ANGLE degrees.
 #ifndef KEYBALL_SCROLLSNAP_ENABLE
 #    define KEYBALL_SCROLLSNAP_ENABLE 1
 #endif
@@ -44,10 +54,328 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #    define KEYBALL_SCROLLSNAP_RESET_TIMER 100
 #endif
 
-#ifndef KEYBALL_SCROLLSNAP_TENSION_THRESHOLD
-#    define KEYBALL_SCROLLSNAP_TENSION_THRESHOLD 12
+#ifndef KEYBALL_SCROLLSNAP_THRESHOLD
+#    define KEYBALL_SCROLLSNAP_THRESHOLD 24
 #endif
 
+#ifndef KEYBALL_SCROLLSNAP_LOCK_ANGLE
+#    define KEYBALL_SCROLLSNAP_LOCK_ANGLE 30
+#endif
+
+#ifndef KEYBALL_SCROLLSNAP_UNLOCK_ANGLE
+#    define KEYBALL_SCROLLSNAP_UNLOCK_ANGLE 45
+#endif
+
+/// KEYBALL_SCROLL_ACCEL_ENABLE enables acceleration of scroll, apart from
+/// the pointer's one.  Gain of scroll is x1 while motion in a report is up to
+/// KEYBALL_SCROLL_ACCEL_OFFSET counts, for precise scroll by lines.  Beyond
+/// that, it increases KEYBALL_SCROLL_ACCEL_SLOPE/256 per count, up to
+/// KEYBALL_SCROLL_ACCEL_MAX/256.  Profiles can override the slope.
+#ifndef KEYBALL_SCROLL_ACCEL_ENABLE
+#    define KEYBALL_SCROLL_ACCEL_ENABLE 0
+#endif
+
+#ifndef KEYBALL_SCROLL_ACCEL_OFFSET
+#    define KEYBALL_SCROLL_ACCEL_OFFSET 4
+#endif
+
+#ifndef KEYBALL_SCROLL_ACCEL_SLOPE
+#    define KEYBALL_SCROLL_ACCEL_SLOPE 32
+#endif
+
+#ifndef KEYBALL_SCROLL_ACCEL_MAX
+#    define KEYBALL_SCROLL_ACCEL_MAX 2048
+#endif
+
+/// KEYBALL_SCROLL_COALESCE_ENABLE enables coalescing of wheel reports.  Wheel
+/// in reports without pointer motion is held and sent together, when
+/// KEYBALL_SCROLL_COALESCE_BUDGET ms passed from the first held one or it
+/// reaches KEYBALL_SCROLL_COALESCE_LIMIT units.  The budget should be a
+/// multiple of KEYBALL_REPORTMOUSE_INTERVAL.
+#ifndef KEYBALL_SCROLL_COALESCE_ENABLE
+#    define KEYBALL_SCROLL_COALESCE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_SCROLL_COALESCE_BUDGET
+#    define KEYBALL_SCROLL_COALESCE_BUDGET (KEYBALL_REPORTMOUSE_INTERVAL * 3)
+#endif
+
+#ifndef KEYBALL_SCROLL_COALESCE_LIMIT
+#    define KEYBALL_SCROLL_COALESCE_LIMIT 8
+#endif
+
+/// KEYBALL_SCROLL_DAMPEN_ENABLE enables dampening of scroll reversal, which
+/// happens when a finger leaves a trackball.  After scroll of
+/// KEYBALL_SCROLL_DAMPEN_SUSTAIN counts in a direction, reverse motion within
+/// KEYBALL_SCROLL_DAMPEN_TIME ms is discarded until it reaches
+/// KEYBALL_SCROLL_DAMPEN_THRESHOLD counts.
+#ifndef KEYBALL_SCROLL_DAMPEN_ENABLE
+#    define KEYBALL_SCROLL_DAMPEN_ENABLE 0
+#endif
+
+#ifndef KEYBALL_SCROLL_DAMPEN_SUSTAIN
+#    define KEYBALL_SCROLL_DAMPEN_SUSTAIN 32
+#endif
+
+#ifndef KEYBALL_SCROLL_DAMPEN_TIME
+#    define KEYBALL_SCROLL_DAMPEN_TIME 100
+#endif
+
+#ifndef KEYBALL_SCROLL_DAMPEN_THRESHOLD
+#    define KEYBALL_SCROLL_DAMPEN_THRESHOLD 6
+#endif
+
+/// KEYBALL_LAYER_PROFILE_ENABLE enables per-layer pointer profiles.
+/// When enabled, keymap should define keyball_layer_profiles[] table.
+#ifndef KEYBALL_LAYER_PROFILE_ENABLE
+#    define KEYBALL_LAYER_PROFILE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_LAYER_PROFILE_COUNT
+#    define KEYBALL_LAYER_PROFILE_COUNT 8
+#endif
+
+/// KEYBALL_HOST_PROFILE_ENABLE enables host profiles, which a helper on the
+/// host switches by raw HID commands, for example on change of focused
+/// application.  Keymap should define keyball_host_profiles[] table.  A host
+/// profile is applied without writing EEPROM, while the highest layer has no
+/// layer profile.  It requires RAW_ENABLE (or VIA_ENABLE).  See hostprofile/
+/// for a reference client and a loopback harness.
+#ifndef KEYBALL_HOST_PROFILE_ENABLE
+#    define KEYBALL_HOST_PROFILE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_HOST_PROFILE_COUNT
+#    define KEYBALL_HOST_PROFILE_COUNT 8
+#endif
+
+// KEYBALL_PROFILE_ENABLE is true when profiles can be applied.
+#define KEYBALL_PROFILE_ENABLE (KEYBALL_LAYER_PROFILE_ENABLE || KEYBALL_HOST_PROFILE_ENABLE)
+
+/// KEYBALL_TYPING_GUARD_ENABLE enables to discard small motion of trackballs
+/// while typing.  After pressing a key other than mouse keys, modifiers,
+/// layer keys (MO, TG, LT, LM and OSL), mod-taps, one-shot modifiers and
+/// Keyball's keycodes, motion is discarded for KEYBALL_TYPING_GUARD_TIME ms
+/// until accumulated motion exceeds KEYBALL_TYPING_GUARD_THRESHOLD counts.
+#ifndef KEYBALL_TYPING_GUARD_ENABLE
+#    define KEYBALL_TYPING_GUARD_ENABLE 0
+#endif
+
+#ifndef KEYBALL_TYPING_GUARD_TIME
+#    define KEYBALL_TYPING_GUARD_TIME 200
+#endif
+
+#ifndef KEYBALL_TYPING_GUARD_THRESHOLD
+#    define KEYBALL_TYPING_GUARD_THRESHOLD 16
+#endif
+
+/// KEYBALL_NOISE_GATE_ENABLE enables a noise gate for jitter of stationary
+/// trackballs.  The gate opens when accumulated motion reaches
+/// KEYBALL_NOISE_GATE_THRESHOLD counts, and closes when no motion comes for
+/// KEYBALL_NOISE_GATE_TIMEOUT ms.  No mouse reports are made while closed.
+#ifndef KEYBALL_NOISE_GATE_ENABLE
+#    define KEYBALL_NOISE_GATE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_NOISE_GATE_THRESHOLD
+#    define KEYBALL_NOISE_GATE_THRESHOLD 3
+#endif
+
+#ifndef KEYBALL_NOISE_GATE_TIMEOUT
+#    define KEYBALL_NOISE_GATE_TIMEOUT 100
+#endif
+
+/// KEYBALL_ROTATION_ENABLE enables rotation of trackball motion in firmware,
+/// for mounting angles which sensor's Angle_Tune (±30°) can't cover.
+#ifndef KEYBALL_ROTATION_ENABLE
+#    define KEYBALL_ROTATION_ENABLE 0
+#endif
+
+/// KEYBALL_MOTION_RING_SIZE is count of samples in a ring buffer which passes
+/// motion from the sensor to the consumer (report builder or split RPC).
+/// It must be power of 2, and 128 or less.
+#ifndef KEYBALL_MOTION_RING_SIZE
+#    define KEYBALL_MOTION_RING_SIZE 8
+#endif
+
+/// KEYBALL_HISTORY_ENABLE enables history of motion per trackball, and
+/// velocity estimation over last KEYBALL_HISTORY_WINDOW ms with it.
+#ifndef KEYBALL_HISTORY_ENABLE
+#    define KEYBALL_HISTORY_ENABLE 0
+#endif
+
+#ifndef KEYBALL_HISTORY_SIZE
+#    define KEYBALL_HISTORY_SIZE 16
+#endif
+
+#ifndef KEYBALL_HISTORY_WINDOW
+#    define KEYBALL_HISTORY_WINDOW 50
+#endif
+
+/// KEYBALL_KINETIC_SCROLL_ENABLE enables kinetic scroll.  When a scrolling
+/// trackball is released (no motion for KEYBALL_KINETIC_SCROLL_RELEASE ms)
+/// faster than KEYBALL_KINETIC_SCROLL_THRESHOLD counts per
+/// KEYBALL_KINETIC_SCROLL_INTERVAL ms, scroll continues with the release
+/// velocity.  Every KEYBALL_KINETIC_SCROLL_INTERVAL ms, the velocity loses
+/// KEYBALL_KINETIC_SCROLL_FRICTION/256 of itself.  New motion or key press
+/// stops it.  It requires (and enables) KEYBALL_HISTORY_ENABLE.
+#ifndef KEYBALL_KINETIC_SCROLL_ENABLE
+#    define KEYBALL_KINETIC_SCROLL_ENABLE 0
+#endif
+
+#if KEYBALL_KINETIC_SCROLL_ENABLE && !KEYBALL_HISTORY_ENABLE
+#    undef KEYBALL_HISTORY_ENABLE
+#    define KEYBALL_HISTORY_ENABLE 1
+#endif
+
+#ifndef KEYBALL_KINETIC_SCROLL_RELEASE
+#    define KEYBALL_KINETIC_SCROLL_RELEASE 40
+#endif
+
+#ifndef KEYBALL_KINETIC_SCROLL_INTERVAL
+#    define KEYBALL_KINETIC_SCROLL_INTERVAL 16
+#endif
+
+#ifndef KEYBALL_KINETIC_SCROLL_THRESHOLD
+#    define KEYBALL_KINETIC_SCROLL_THRESHOLD 4
+#endif
+
+#ifndef KEYBALL_KINETIC_SCROLL_FRICTION
+#    define KEYBALL_KINETIC_SCROLL_FRICTION 12
+#endif
+
+/// KEYBALL_AUTO_MOUSE_ENABLE enables auto mouse layer.  The layer
+/// KEYBALL_AUTO_MOUSE_LAYER is turned on when pointer motion in mouse reports
+/// reaches KEYBALL_AUTO_MOUSE_THRESHOLD counts, and turned off when no motion
+/// comes for KEYBALL_AUTO_MOUSE_TIMEOUT ms or other than ignored keys are
+/// pressed.  Ignored keys are mouse keys, modifiers, Keyball's keycodes, MO()
+/// and keys which keyball_auto_mouse_ignore() returns true for.  The layer is
+/// held while ignored keys are pressed.
+#ifndef KEYBALL_AUTO_MOUSE_ENABLE
+#    define KEYBALL_AUTO_MOUSE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_AUTO_MOUSE_LAYER
+#    define KEYBALL_AUTO_MOUSE_LAYER 1
+#endif
+
+#ifndef KEYBALL_AUTO_MOUSE_THRESHOLD
+#    define KEYBALL_AUTO_MOUSE_THRESHOLD 2
+#endif
+
+#ifndef KEYBALL_AUTO_MOUSE_TIMEOUT
+#    define KEYBALL_AUTO_MOUSE_TIMEOUT 800
+#endif
+
+/// KEYBALL_GESTURE_ENABLE enables flick gestures of trackballs.  While GES_ARM
+/// is held, pointer motion is not reported but accumulated to a stroke.  When
+/// a stroke reaches KEYBALL_GESTURE_THRESHOLD counts within
+/// KEYBALL_GESTURE_TIME ms in a direction, a keycode from
+/// keyball_gesture_map[] is tapped.  Only one gesture is made in a window.
+#ifndef KEYBALL_GESTURE_ENABLE
+#    define KEYBALL_GESTURE_ENABLE 0
+#endif
+
+#ifndef KEYBALL_GESTURE_THRESHOLD
+#    define KEYBALL_GESTURE_THRESHOLD 120
+#endif
+
+#ifndef KEYBALL_GESTURE_TIME
+#    define KEYBALL_GESTURE_TIME 300
+#endif
+
+#ifndef KEYBALL_GESTURE_LAYER_COUNT
+#    define KEYBALL_GESTURE_LAYER_COUNT 1
+#endif
+
+/// KEYBALL_ARROW_ENABLE enables arrow mode, which taps arrow keys by motion of
+/// the primary trackball instead of moving pointer.  A key is tapped per
+/// KEYBALL_ARROW_DIVIDER counts along an axis, at most once per
+/// KEYBALL_ARROW_INTERVAL ms.  Motion is locked to the first dominant axis
+/// until no motion comes for KEYBALL_ARROW_RELEASE ms.  Taps waiting for the
+/// interval are limited to KEYBALL_ARROW_QUEUE.
+#ifndef KEYBALL_ARROW_ENABLE
+#    define KEYBALL_ARROW_ENABLE 0
+#endif
+
+#ifndef KEYBALL_ARROW_DIVIDER
+#    define KEYBALL_ARROW_DIVIDER 40
+#endif
+
+#ifndef KEYBALL_ARROW_INTERVAL
+#    define KEYBALL_ARROW_INTERVAL 30
+#endif
+
+#ifndef KEYBALL_ARROW_RELEASE
+#    define KEYBALL_ARROW_RELEASE 150
+#endif
+
+#ifndef KEYBALL_ARROW_QUEUE
+#    define KEYBALL_ARROW_QUEUE 4
+#endif
+
+#ifndef KEYBALL_ARROW_KEY_UP
+#    define KEYBALL_ARROW_KEY_UP KC_UP
+#endif
+
+#ifndef KEYBALL_ARROW_KEY_DOWN
+#    define KEYBALL_ARROW_KEY_DOWN KC_DOWN
+#endif
+
+#ifndef KEYBALL_ARROW_KEY_LEFT
+#    define KEYBALL_ARROW_KEY_LEFT KC_LEFT
+#endif
+
+#ifndef KEYBALL_ARROW_KEY_RIGHT
+#    define KEYBALL_ARROW_KEY_RIGHT KC_RGHT
+#endif
+
+/// KEYBALL_ROLE_KEY_DIVIDER is counts of vertical motion for a tap of
+/// KEYBALL_ROLE_VOLUME and KEYBALL_ROLE_BRIGHTNESS.
+#ifndef KEYBALL_ROLE_KEY_DIVIDER
+#    define KEYBALL_ROLE_KEY_DIVIDER 32
+#endif
+
+/// KEYBALL_DRAG_LOCK_ENABLE enables DRG_LCK and CLK_HLD, which latch the left
+/// mouse button.  CLK_HLD holds it until the key or a mouse button is pressed
+/// again.  DRG_LCK also releases it when trackballs get idle for
+/// KEYBALL_DRAG_LOCK_IDLE ms after motion, or when no motion comes for
+/// KEYBALL_DRAG_LOCK_TIMEOUT ms after latched.
+#ifndef KEYBALL_DRAG_LOCK_ENABLE
+#    define KEYBALL_DRAG_LOCK_ENABLE 0
+#endif
+
+#ifndef KEYBALL_DRAG_LOCK_IDLE
+#    define KEYBALL_DRAG_LOCK_IDLE 500
+#endif
+
+#ifndef KEYBALL_DRAG_LOCK_TIMEOUT
+#    define KEYBALL_DRAG_LOCK_TIMEOUT 3000
+#endif
+
+/// KEYBALL_ZOOM_PAN_ENABLE enables KEYBALL_ROLE_ZOOM and KEYBALL_ROLE_PAN,
+/// and ZOOM_MO and PAN_MO which turn scrolling trackballs into them while
+/// pressed.  Zoom reports vertical wheel with KEYBALL_ZOOM_MODS, which are
+/// released when no wheel comes for KEYBALL_ZOOM_RELEASE ms.  Pan reports
+/// vertical motion as horizontal wheel.
+#ifndef KEYBALL_ZOOM_PAN_ENABLE
+#    define KEYBALL_ZOOM_PAN_ENABLE 0
+#endif
+
+#ifndef KEYBALL_ZOOM_MODS
+#    define KEYBALL_ZOOM_MODS MOD_BIT(KC_LCTL)
+#endif
+
+#ifndef KEYBALL_ZOOM_RELEASE
+#    define KEYBALL_ZOOM_RELEASE 100
+#endif
+
+/// DEBUG_KEYBALL_REPORT_SKIP enables counters of built and skipped mouse
+/// reports, to measure how many report cycles are saved at idle.  Counts in
+/// a last second will be logged when defined CONSOLE_ENABLE and
+/// `debug_enable = true`.
+//#define DEBUG_KEYBALL_REPORT_SKIP
+
 //////////////////////////////////////////////////////////////////////////////
 // Constants
 
@@ -55,6 +383,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define KEYBALL_TX_GETINFO_MAXTRY 10
 #define KEYBALL_TX_GETMOTION_INTERVAL 4
 
+// Raw HID commands for host profiles.  A request is [KEYBALL_RAW_ID,
+// command, argument], and its reply is [KEYBALL_RAW_ID, command, status,
+// value] in the same length.  Status is 0 for success.
+//
+//   KEYBALL_RAW_SET_PROFILE: apply a host profile 1~KEYBALL_HOST_PROFILE_COUNT
+//                            given by argument, or 0 for none.  Value is the
+//                            applied one.
+//   KEYBALL_RAW_GET_PROFILE: value is the current host profile.
+#define KEYBALL_RAW_ID 0x4b // 'K'
+#define KEYBALL_RAW_SET_PROFILE 0x01
+#define KEYBALL_RAW_GET_PROFILE 0x02
+
 #if (PRODUCT_ID & 0xff00) == 0x0000
 #    define KEYBALL_MODEL 46
 #elif (PRODUCT_ID & 0xff00) == 0x0100
@@ -86,6 +426,42 @@ enum keyball_keycodes {
     SCRL_DVI = QK_KB_8, // Increment scroll divider
     SCRL_DVD = QK_KB_9, // Decrement scroll divider
 
+    // Rotate motion of trackballs clockwise (I) or counterclockwise (D).
+    ROT_I1  = QK_KB_10, // Rotation +1 degree
+    ROT_D1  = QK_KB_11, // Rotation -1 degree
+    ROT_I15 = QK_KB_12, // Rotation +15 degrees
+    ROT_D15 = QK_KB_13, // Rotation -15 degrees
+
+    // Scale motion of pointer per screen axis, by 1/8 steps.
+    SCX_I = QK_KB_14, // Increment horizontal scale
+    SCX_D = QK_KB_15, // Decrement horizontal scale
+    SCY_I = QK_KB_16, // Increment vertical scale
+    SCY_D = QK_KB_17, // Decrement vertical scale
+
+    GES_ARM = QK_KB_18, // Arm ball gestures while pressed
+
+    // In arrow mode, motion from primary trackball taps arrow keys.
+    ARRW_TO = QK_KB_19, // Toggle arrow mode
+    ARRW_MO = QK_KB_20, // Momentary arrow mode
+
+    // Latch left mouse button, until pressed again.
+    DRG_LCK = QK_KB_21, // Drag lock: released by idle after motion too
+    CLK_HLD = QK_KB_22, // Click hold: released by press only
+
+    // Lock scroll to an axis.
+    SSNP_VRT = QK_KB_23, // Scroll snap: vertical only
+    SSNP_HOR = QK_KB_24, // Scroll snap: horizontal only
+    SSNP_FRE = QK_KB_25, // Scroll snap: free
+    SSNP_AUT = QK_KB_26, // Scroll snap: lock to dominant axis
+
+    // Turn scroll into zoom or horizontal pan while pressed.
+    ZOOM_MO = QK_KB_27, // Momentary zoom: Ctrl + wheel
+    PAN_MO  = QK_KB_28, // Momentary pan: horizontal wheel
+
+    // Step scroll divider by 1/4, between steps of SCRL_DVI and SCRL_DVD.
+    SCRL_DFI = QK_KB_29, // Increment scroll divider by 1/4
+    SCRL_DFD = QK_KB_30, // Decrement scroll divider by 1/4
+
     // User customizable 32 keycodes.
     KEYBALL_SAFE_RANGE = QK_USER_0,
 };
@@ -93,11 +469,33 @@ enum keyball_keycodes {
 typedef union {
     uint32_t raw;
     struct {
-        uint8_t cpi : 7;
-        uint8_t sdiv : 3; // scroll divider
+        uint8_t  cpi : 7;
+        uint8_t  sdiv : 3; // scroll divider
+        uint8_t  scx : 4;  // horizontal scale (fill a gap of bits)
+        uint16_t rot : 9;  // rotation angle in degrees
+        uint8_t  scy : 4;  // vertical scale
+        uint8_t  ssnp : 2; // keyball_scrollsnap_mode_t
     };
 } keyball_config_t;
 
+/// keyball_ext_config_t is configuration which doesn't fit keyball_config_t.
+typedef union {
+    uint32_t raw;
+    struct {
+        uint8_t this_role : 4; // keyball_role_t of this side's trackball
+        uint8_t that_role : 4; // keyball_role_t of other side's trackball
+        uint8_t sdiv_frac : 2; // fraction of scroll divider in 1/4 steps
+    };
+} keyball_ext_config_t;
+
+/// keyball_eeconfig_t is whole configuration stored to EEPROM as kb datablock
+/// (EECONFIG_KB_DATA_SIZE).  Older firmwares stored keyball_config_t in kb
+/// dword, which is migrated while the datablock isn't valid.
+typedef struct {
+    keyball_config_t     config;
+    keyball_ext_config_t ext;
+} keyball_eeconfig_t;
+
 typedef struct {
     uint8_t ballcnt; // count of balls: support only 0 or 1, for now
 } keyball_info_t;
@@ -110,28 +508,283 @@ typedef struct {
 typedef uint8_t keyball_cpi_t;
 
 typedef struct {
+    int16_t  x;
+    int16_t  y;
+    uint32_t time; // timer_read32() when pushed
+} keyball_sample_t;
+
+/// keyball_ring_t is a lock-free ring buffer of motion samples, for single
+/// producer and single consumer.  Only producer writes head and spill, and
+/// only consumer writes tail.
+typedef struct {
+    keyball_sample_t buf[KEYBALL_MOTION_RING_SIZE];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    keyball_motion_t spill; // motion which couldn't be pushed for full
+} keyball_ring_t;
+
+typedef struct {
+    bool     open;
+    uint32_t last; // time of last motion
+} keyball_gate_t;
+
+typedef enum {
+    KEYBALL_BALL_THIS = 0, // trackball on this side
+    KEYBALL_BALL_THAT = 1, // trackball on the other side
+} keyball_ball_t;
+
+/// keyball_history_t is a ring buffer of motion samples in screen axes, with
+/// sums of samples in the window for velocity estimation.
+typedef struct {
+    keyball_sample_t buf[KEYBALL_HISTORY_SIZE];
+    uint8_t          head; // index of next sample
+    uint8_t          count;
+    uint32_t         since; // time of the last dropped sample
+    int32_t          sum_x;
+    int32_t          sum_y;
+} keyball_history_t;
+
+/// keyball_velocity_t is velocity of a trackball in 1/256 counts per ms.
+typedef struct {
+    int16_t x;
+    int16_t y;
+} keyball_velocity_t;
+
+typedef enum {
+    KEYBALL_ACCEL_NONE = 0,
+    KEYBALL_ACCEL_LOW  = 1,
+    KEYBALL_ACCEL_MID  = 2,
+    KEYBALL_ACCEL_HIGH = 3,
+} keyball_accel_t;
+
+typedef enum {
+    KEYBALL_AXIS_FREE       = 0,
+    KEYBALL_AXIS_HORIZONTAL = 1, // allow horizontal motion only
+    KEYBALL_AXIS_VERTICAL   = 2, // allow vertical motion only
+} keyball_axis_t;
+
+/// keyball_scrollsnap_mode_t is a mode of scroll snap.
+typedef enum {
+    KEYBALL_SCROLLSNAP_MODE_AUTO       = 0, // lock to dominant axis
+    KEYBALL_SCROLLSNAP_MODE_VERTICAL   = 1, // allow vertical scroll only
+    KEYBALL_SCROLLSNAP_MODE_HORIZONTAL = 2, // allow horizontal scroll only
+    KEYBALL_SCROLLSNAP_MODE_FREE       = 3, // don't lock
+} keyball_scrollsnap_mode_t;
+
+/// keyball_dampen_t is state of scroll reversal dampening for an axis.
+typedef struct {
+    int8_t   dir;     // direction of sustained scroll: 1, -1 or 0
+    int16_t  run;     // counts scrolled in the direction
+    int16_t  reverse; // reverse counts which are discarded
+    uint32_t last;    // time of last motion in the direction
+} keyball_dampen_t;
+
+/// keyball_profile_t is a set of pointer parameters which follow layers.
+/// Zero for cpi, sdiv, ssnp or roles means to use values configured by
+/// keycodes, and zero for friction or scroll_accel means its default in
+/// config.
+typedef struct {
+    uint8_t cpi;          // CPI / 100
+    uint8_t sdiv;         // scroll divider
+    uint8_t accel;        // keyball_accel_t
+    uint8_t axis;         // keyball_axis_t
+    uint8_t this_role;    // keyball_role_t, AUTO to use configured role
+    uint8_t that_role;    // keyball_role_t, AUTO to use configured role
+    uint8_t friction;     // kinetic scroll friction in 1/256 per interval
+    uint8_t scroll_accel; // slope of scroll acceleration in 1/256 per count
+    uint8_t ssnp;         // keyball_scrollsnap_mode_t + 1
+} keyball_profile_t;
+
+/// keyball_axis_map_t maps axes of a sensor to screen axes.
+typedef struct {
+    uint8_t swap : 1;  // swap X and Y
+    uint8_t neg_x : 1; // negate X on screen
+    uint8_t neg_y : 1; // negate Y on screen
+} keyball_axis_map_t;
+
+/// keyball_topology_t describes physical layout of the keyboard.  It is
+/// resolved once at initialization, so that hot paths don't peek GPIO for
+/// handedness.  Presence of trackballs is this_have_ball and that_have_ball.
+typedef struct {
+    bool               ready;   // resolved already
+    bool               is_left; // this side is left
+    keyball_axis_map_t axis[2]; // indexed by keyball_ball_t
+} keyball_topology_t;
+
+typedef struct {
+    keyball_topology_t topo;
+
     bool this_have_ball;
     bool that_enable;
     bool that_have_ball;
 
+    keyball_ring_t   this_ring; // motion from the sensor
     keyball_motion_t this_motion;
     keyball_motion_t that_motion;
 
+    // true when new motion came after last mouse report.
+    bool motion_pending;
+
+#if KEYBALL_NOISE_GATE_ENABLE
+    keyball_gate_t this_gate;
+    keyball_gate_t that_gate;
+#endif
+
+#if KEYBALL_HISTORY_ENABLE
+    keyball_history_t this_history;
+    keyball_history_t that_history;
+#endif
+
+    // sub-count remainders of fixed-point motion stages (Q8).
+    keyball_motion_t this_carry;
+    keyball_motion_t that_carry;
+
+    // remainders of wheel units of scroll (Q12), apart from pointer's ones.
+    keyball_motion_t this_scroll_carry;
+    keyball_motion_t that_scroll_carry;
+
+    uint8_t scale_x; // 1/8 unit, 0 means default (8/8)
+    uint8_t scale_y;
+
+#if KEYBALL_ROTATION_ENABLE
+    uint16_t         rotation; // degrees, clockwise on screen
+    keyball_motion_t this_rot_carry;
+    keyball_motion_t that_rot_carry;
+#endif
+
     uint8_t cpi_value;
+    uint8_t cpi_applied; // effective CPI which was applied to sensor
     bool    cpi_changed;
 
+#if KEYBALL_PROFILE_ENABLE
+    keyball_profile_t profile;
+#endif
+#if KEYBALL_HOST_PROFILE_ENABLE
+    uint8_t host_profile; // host profile by raw HID, 0 for none
+#endif
+
+    uint8_t this_role; // configured keyball_role_t of trackballs
+    uint8_t that_role;
+    int16_t this_keys; // motion not tapped yet for key roles
+    int16_t that_keys;
+
     bool     scroll_mode;
     uint32_t scroll_mode_changed;
     uint8_t  scroll_div;
+    uint8_t  scroll_div_frac; // 1/4 steps between scroll_div and the next
+
+#if KEYBALL_SCROLL_ACCEL_ENABLE
+    keyball_motion_t this_scroll_accel_carry; // fraction of accelerated units
+    keyball_motion_t that_scroll_accel_carry;
+#endif
+
+#if KEYBALL_SCROLL_DAMPEN_ENABLE
+    keyball_dampen_t this_dampen[2];          // per axis of sensors
+    keyball_dampen_t that_dampen[2];
+    uint32_t         scroll_dampen_count;     // count of discarded reversals
+    uint32_t         scroll_dampen_discarded; // total counts of discarded motion
+#endif
+
+#if KEYBALL_SCROLL_COALESCE_ENABLE
+    int16_t  coalesce_h;     // wheel held to be sent together
+    int16_t  coalesce_v;
+    uint32_t coalesce_since; // time of the first held wheel
+#endif
 
+#if KEYBALL_SCROLLSNAP_ENABLE
+    uint8_t  scroll_snap_mode;    // keyball_scrollsnap_mode_t
+    uint8_t  scroll_snap_axis;    // keyball_axis_t locked in auto mode
+    bool     scroll_snap_decided; // direction is decided in auto mode
+    uint16_t scroll_snap_x;       // leaky sum of motion on screen axes
+    uint16_t scroll_snap_y;
     uint32_t scroll_snap_last;
-    int8_t   scroll_snap_tension_h;
+#endif
+
+#if KEYBALL_AUTO_MOUSE_ENABLE
+    bool     aml_enable;   // auto mouse layer is enabled
+    bool     aml_active;   // auto mouse layer is turned on
+    uint8_t  aml_held;     // count of pressed ignored keys
+    uint16_t aml_distance; // motion accumulated to turn on the layer
+    uint32_t aml_last;     // time of last motion or release of ignored key
+#endif
+
+#if KEYBALL_ARROW_ENABLE
+    bool     arrow_mode;
+    uint8_t  arrow_axis;   // locked axis: keyball_axis_t
+    int16_t  arrow_x;      // motion not tapped yet, on screen axes
+    int16_t  arrow_y;
+    uint32_t arrow_last;   // time of last tap
+    uint32_t arrow_motion; // time of last motion
+#endif
+
+#if KEYBALL_ZOOM_PAN_ENABLE
+    uint8_t  wheel_role; // role of scrolling trackballs by ZOOM_MO or PAN_MO
+    bool     zoom_mods;  // KEYBALL_ZOOM_MODS are added
+    uint32_t zoom_last;  // time of last zoom
+#endif
+
+#if KEYBALL_DRAG_LOCK_ENABLE
+    uint8_t  drag_btn;   // latched button + 1, or 0
+    bool     drag_hold;  // latched by CLK_HLD
+    bool     drag_moved; // motion came while latched
+    uint32_t drag_last;  // time of latch or last motion
+#endif
+
+#if KEYBALL_GESTURE_ENABLE
+    bool     gesture_armed; // true while GES_ARM is pressed
+    bool     gesture_fired; // a gesture was made in current stroke
+    int16_t  gesture_x;     // stroke on screen axes
+    int16_t  gesture_y;
+    uint32_t gesture_start; // time of start of current stroke
+#endif
+
+#if KEYBALL_KINETIC_SCROLL_ENABLE
+    bool             kinetic_armed;  // a scrolling trackball is moving
+    bool             kinetic_active; // scroll continues by momentum
+    uint8_t          kinetic_ball;   // keyball_ball_t of the momentum
+    uint32_t         kinetic_last;   // time of last motion or last step
+    int16_t          kinetic_x;      // velocity in Q8 counts per interval
+    int16_t          kinetic_y;      //   on screen axes
+    keyball_motion_t kinetic_carry;
+#endif
+
+#if KEYBALL_TYPING_GUARD_ENABLE
+    bool     typing_guard;           // true while guarding motion
+    uint32_t typing_guard_last;      // time of last typing
+    uint16_t typing_guard_distance;  // motion accumulated in a guard
+    uint32_t typing_guard_count;     // count of reports which discarded motion
+    uint32_t typing_guard_discarded; // total counts of discarded motion
+#endif
 
     uint16_t       last_kc;
     keypos_t       last_pos;
     report_mouse_t last_mouse;
 } keyball_t;
 
+/// keyball_role_t is a role of a trackball.  With KEYBALL_ROLE_AUTO, modes
+/// (scroll mode and arrow mode) switch role of the primary trackball, and
+/// the other one works as scroll wheel while the primary one is pointer.
+typedef enum {
+    KEYBALL_ROLE_AUTO       = 0, // follow modes
+    KEYBALL_ROLE_POINTER    = 1, // move pointer
+    KEYBALL_ROLE_SCROLL     = 2, // scroll wheel
+    KEYBALL_ROLE_ARROW      = 3, // tap arrow keys
+    KEYBALL_ROLE_VOLUME     = 4, // tap volume up/down keys
+    KEYBALL_ROLE_BRIGHTNESS = 5, // tap brightness up/down keys
+    KEYBALL_ROLE_CUSTOM     = 6, // call keyball_on_custom_role()
+    KEYBALL_ROLE_ZOOM       = 7, // vertical wheel with KEYBALL_ZOOM_MODS
+    KEYBALL_ROLE_PAN        = 8, // horizontal wheel by vertical motion
+    KEYBALL_ROLE_COUNT,
+} keyball_role_t;
+
+typedef enum {
+    KEYBALL_GESTURE_UP    = 0,
+    KEYBALL_GESTURE_DOWN  = 1,
+    KEYBALL_GESTURE_LEFT  = 2,
+    KEYBALL_GESTURE_RIGHT = 3,
+    KEYBALL_GESTURE_COUNT,
+} keyball_gesture_t;
+
 typedef enum {
     KEYBALL_ADJUST_PENDING   = 0,
     KEYBALL_ADJUST_PRIMARY   = 1,
@@ -143,6 +796,66 @@ typedef enum {
 
 extern keyball_t keyball;
 
+#if KEYBALL_LAYER_PROFILE_ENABLE
+/// keyball_layer_profiles is a table of pointer profiles, indexed by the
+/// highest active layer.  Keymap should define this with PROGMEM.
+///
+/// Example:
+///
+///     const keyball_profile_t PROGMEM keyball_layer_profiles[KEYBALL_LAYER_PROFILE_COUNT] = {
+///         [3] = {.cpi = 4, .sdiv = 6, .axis = KEYBALL_AXIS_VERTICAL},
+///         [4] = {.accel = KEYBALL_ACCEL_MID},
+///         [5] = {.that_role = KEYBALL_ROLE_VOLUME},
+///     };
+extern const keyball_profile_t keyball_layer_profiles[KEYBALL_LAYER_PROFILE_COUNT];
+#endif
+
+#if KEYBALL_HOST_PROFILE_ENABLE
+/// keyball_host_profiles is a table of pointer profiles, which the host
+/// selects by KEYBALL_RAW_SET_PROFILE.  Profile N is at index N - 1.  Keymap
+/// should define this with PROGMEM.
+///
+/// Example:
+///
+///     const keyball_profile_t PROGMEM keyball_host_profiles[KEYBALL_HOST_PROFILE_COUNT] = {
+///         [0] = {.sdiv = 3, .ssnp = KEYBALL_SCROLLSNAP_MODE_FREE + 1},
+///         [1] = {.sdiv = 6, .ssnp = KEYBALL_SCROLLSNAP_MODE_VERTICAL + 1},
+///     };
+extern const keyball_profile_t keyball_host_profiles[KEYBALL_HOST_PROFILE_COUNT];
+
+/// keyball_raw_command handles a raw HID command for host profiles, and
+/// replies to it.  It returns false for packets of others.  Without VIA,
+/// Keyball defines raw_hid_receive() as weak, so a keymap which has its own
+/// raw HID commands should define it and call this first:
+///
+///     void raw_hid_receive(uint8_t *data, uint8_t length) {
+///         if (keyball_raw_command(data, length)) {
+///             return;
+///         }
+///         // commands of the keymap.
+///     }
+bool keyball_raw_command(uint8_t *data, uint8_t length);
+#endif
+
+#if KEYBALL_GESTURE_ENABLE
+/// keyball_gesture_map is a table of keycodes for gestures, indexed by the
+/// highest active layer and keyball_gesture_t.  The first row is used for
+/// layers beyond KEYBALL_GESTURE_LAYER_COUNT.  Keycodes are sent with
+/// tap_code16(), so basic keycodes with modifiers are available.
+///
+/// Example:
+///
+///     const uint16_t PROGMEM keyball_gesture_map[KEYBALL_GESTURE_LAYER_COUNT][KEYBALL_GESTURE_COUNT] = {
+///         [0] = {
+///             [KEYBALL_GESTURE_UP]    = LCTL(KC_UP),
+///             [KEYBALL_GESTURE_DOWN]  = LCTL(KC_DOWN),
+///             [KEYBALL_GESTURE_LEFT]  = LCTL(KC_LEFT),
+///             [KEYBALL_GESTURE_RIGHT] = LCTL(KC_RGHT),
+///         },
+///     };
+extern const uint16_t keyball_gesture_map[KEYBALL_GESTURE_LAYER_COUNT][KEYBALL_GESTURE_COUNT];
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 // Public API functions
 
@@ -159,6 +872,47 @@ void keyball_oled_render_keyinfo(void);
 /// inactive layers.
 void keyball_oled_render_layerinfo(void);
 
+/// keyball_auto_mouse_ignore is a hook point, which returns true for keycodes
+/// which shouldn't turn off auto mouse layer, such as custom mouse buttons.
+bool keyball_auto_mouse_ignore(uint16_t keycode);
+
+/// keyball_get_auto_mouse_layer_enable gets auto mouse layer is enabled.
+bool keyball_get_auto_mouse_layer_enable(void);
+
+/// keyball_set_auto_mouse_layer_enable enables or disables auto mouse layer.
+/// It works only when KEYBALL_AUTO_MOUSE_ENABLE is enabled.
+void keyball_set_auto_mouse_layer_enable(bool enable);
+
+/// keyball_send_button sends press or release of a mouse button immediately
+/// with pending motion, bypassing KEYBALL_REPORTMOUSE_INTERVAL.  btn is
+/// index of the button: 0 for left button, 1 for right, 2 for middle and so
+/// on.  Use this for custom mouse button keycodes.
+void keyball_send_button(uint8_t btn, bool pressed);
+
+/// keyball_on_custom_role is a hook point, which is called with motion of a
+/// trackball on screen axes when its role is KEYBALL_ROLE_CUSTOM.  The report
+/// r can be modified to send mouse events.
+void keyball_on_custom_role(keyball_ball_t ball, int16_t x, int16_t y, report_mouse_t *r);
+
+/// keyball_get_role gets configured role of a trackball.
+keyball_role_t keyball_get_role(keyball_ball_t ball);
+
+/// keyball_set_role changes role of a trackball.  The role is saved to EEPROM
+/// by KBC_SAVE, and roles in a profile of a layer take priority over it.
+void keyball_set_role(keyball_ball_t ball, keyball_role_t role);
+
+/// keyball_get_arrow_mode gets current arrow mode.
+bool keyball_get_arrow_mode(void);
+
+/// keyball_set_arrow_mode modify arrow mode.  It works only when
+/// KEYBALL_ARROW_ENABLE is enabled.
+void keyball_set_arrow_mode(bool mode);
+
+/// keyball_toggle_drag_lock latches a mouse button btn, or releases it when
+/// it is latched already.  With hold, timeouts don't release it.  It works
+/// only when KEYBALL_DRAG_LOCK_ENABLE is enabled.
+void keyball_toggle_drag_lock(uint8_t btn, bool hold);
+
 /// keyball_get_scroll_mode gets current scroll mode.
 bool keyball_get_scroll_mode(void);
 
@@ -171,8 +925,64 @@ uint8_t keyball_get_scroll_div(void);
 // TODO: document
 void keyball_set_scroll_div(uint8_t div);
 
+/// keyball_get_scroll_div_frac gets fraction of scroll divider in 1/4 steps.
+uint8_t keyball_get_scroll_div_frac(void);
+
+/// keyball_set_scroll_div_frac sets fraction of scroll divider in 1/4 steps
+/// (0~3), which makes scroll slower between steps of scroll divider.  For
+/// example, divider 4 (1/8) with fraction 2 makes 1/8 * 2^(-2/4) = 1/11.3.
+/// It is not applied while a profile overrides scroll divider.
+void keyball_set_scroll_div_frac(uint8_t frac);
+
+/// keyball_get_scrollsnap_mode gets mode of scroll snap.
+keyball_scrollsnap_mode_t keyball_get_scrollsnap_mode(void);
+
+/// keyball_set_scrollsnap_mode sets mode of scroll snap.  It works only when
+/// KEYBALL_SCROLLSNAP_ENABLE is enabled.
+void keyball_set_scrollsnap_mode(keyball_scrollsnap_mode_t mode);
+
 // TODO: document
 uint8_t keyball_get_cpi(void);
 
 // TODO: document
 void keyball_set_cpi(uint8_t cpi);
+
+/// keyball_get_scale_x gets horizontal scale of pointer motion in 1/8 unit.
+uint8_t keyball_get_scale_x(void);
+
+/// keyball_set_scale_x sets horizontal scale of pointer motion in 1/8 unit
+/// (1~15).  Zero means default scale: 8 (x1.0).
+void keyball_set_scale_x(uint8_t scale);
+
+/// keyball_get_scale_y gets vertical scale of pointer motion in 1/8 unit.
+uint8_t keyball_get_scale_y(void);
+
+/// keyball_set_scale_y sets vertical scale of pointer motion in 1/8 unit
+/// (1~15).  Zero means default scale: 8 (x1.0).
+void keyball_set_scale_y(uint8_t scale);
+
+/// keyball_get_rotation gets rotation angle of trackball motion in degrees
+/// (0~359), clockwise on screen.
+uint16_t keyball_get_rotation(void);
+
+/// keyball_set_rotation sets rotation angle of trackball motion in degrees.
+/// The angle is normalized into 0~359.  It works only when
+/// KEYBALL_ROTATION_ENABLE is enabled.
+void keyball_set_rotation(int16_t deg);
+
+/// keyball_get_velocity gets velocity of a trackball on screen axes, in 1/256
+/// counts per ms.  It is averaged over last KEYBALL_HISTORY_WINDOW ms, and
+/// works only when KEYBALL_HISTORY_ENABLE is enabled.
+keyball_velocity_t keyball_get_velocity(keyball_ball_t ball);
+
+/// keyball_get_history gets a motion sample of a trackball on screen axes.
+/// Index 0 is the newest one.  It returns false when no samples at index,
+/// or KEYBALL_HISTORY_ENABLE is disabled.
+bool keyball_get_history(keyball_ball_t ball, uint8_t index, keyball_sample_t *sample);
+
+/// keyball_apply_profile applies a pointer profile temporarily.
+/// It doesn't modify configuration which is saved to EEPROM, and pushes
+/// only changed parameters to the sensor and the secondary half.  It does
+/// nothing unless KEYBALL_LAYER_PROFILE_ENABLE or KEYBALL_HOST_PROFILE_ENABLE
+/// is enabled.
+void keyball_apply_profile(const keyball_profile_t *profile);
@@ -0,0 +1,135 @@
+// roles_test checks mouse reports when both trackballs have the same role.
+// It runs on a host with minimal declarations of QMK:
+//
+//     $ gcc -Wall -I ../hostprofile/loopback -o roles_test roles_test.c
+//     $ ./roles_test
+
+#include <stdio.h>
+
+#define PRODUCT_ID 0x0001 // Keyball46, which maps both sensors alike
+
+#include "../keyball.c"
+
+layer_state_t layer_state = 1;
+
+uint32_t timer_read32(void) {
+    return 0;
+}
+
+uint16_t timer_read(void) {
+    return 0;
+}
+
+uint8_t get_highest_layer(layer_state_t state) {
+    return 0;
+}
+
+void tap_code16(uint16_t keycode) {}
+
+report_mouse_t pointing_device_get_report(void) {
+    return (report_mouse_t){0};
+}
+
+void pointing_device_set_report(report_mouse_t report) {}
+
+bool pointing_device_send(void) {
+    return true;
+}
+
+bool is_keyboard_master(void) {
+    return true;
+}
+
+bool is_keyboard_left(void) {
+    return true;
+}
+
+bool eeconfig_is_enabled(void) {
+    return false;
+}
+
+uint32_t eeconfig_read_kb(void) {
+    return 0;
+}
+
+void eeconfig_update_kb(uint32_t val) {}
+
+void keyboard_pre_init_user(void) {}
+
+void keyboard_post_init_user(void) {}
+
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+
+layer_state_t layer_state_set_user(layer_state_t state) {
+    return state;
+}
+
+bool pmw3360_init(void) {
+    return true;
+}
+
+void pmw3360_cpi_set(uint8_t cpi) {}
+
+void pmw3360_reg_write(uint8_t addr, uint8_t data) {}
+
+bool pmw3360_motion_burst(pmw3360_motion_t *d) {
+    return false;
+}
+
+static int failed;
+
+static void setup(keyball_role_t role, int16_t this_y, int16_t that_y) {
+    keyball = (keyball_t){0};
+    pointing_device_driver_init();
+    keyball_set_role(KEYBALL_BALL_THIS, role);
+    keyball_set_role(KEYBALL_BALL_THAT, role);
+    keyball.this_motion = (keyball_motion_t){.y = this_y};
+    keyball.that_motion = (keyball_motion_t){.y = that_y};
+}
+
+// report_for makes a report for motion of both trackballs with a role.
+static report_mouse_t report_for(keyball_role_t role, int16_t this_y, int16_t that_y) {
+    setup(role, this_y, that_y);
+    report_mouse_t r = {0};
+    motion_to_report(&r, true);
+    return r;
+}
+
+// report_of makes a report for motion of a trackball alone.
+static report_mouse_t report_of(keyball_ball_t ball, keyball_role_t role, int16_t y) {
+    setup(role, y, y);
+    report_mouse_t r = {0};
+    motion_to_mouse(ball, &r);
+    return r;
+}
+
+static void expect(const char *name, int got, int want) {
+    if (got != want) {
+        printf("FAIL %s: got %d, want %d\n", name, got, want);
+        failed++;
+    }
+}
+
+int main(void) {
+    report_mouse_t a, b, ab;
+
+    a  = report_of(KEYBALL_BALL_THIS, KEYBALL_ROLE_POINTER, 5);
+    b  = report_of(KEYBALL_BALL_THAT, KEYBALL_ROLE_POINTER, 10);
+    ab = report_for(KEYBALL_ROLE_POINTER, 5, 10);
+    expect("pointer", ab.y, a.y + b.y);
+
+    a  = report_of(KEYBALL_BALL_THIS, KEYBALL_ROLE_SCROLL, 40);
+    b  = report_of(KEYBALL_BALL_THAT, KEYBALL_ROLE_SCROLL, 80);
+    ab = report_for(KEYBALL_ROLE_SCROLL, 40, 80);
+    expect("scroll", ab.v, a.v + b.v);
+
+    ab = report_for(KEYBALL_ROLE_POINTER, 120, 120);
+    expect("pointer saturation", abs(ab.y), 127);
+
+    if (failed == 0) {
+        printf("OK\n");
+    }
+    return failed == 0 ? 0 : 1;
+}